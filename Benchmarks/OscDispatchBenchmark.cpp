@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+/*
+    Compares resolving an incoming "/module/0/..." address to a parameter index
+    the old way (substring + std::map<String,int>) against OscAddressDispatcher.
+    First checks that the default routes still send what they always did to the
+    mixer, and returns 1 if they don't.
+
+    usage: OscDispatchBenchmark [numParameters] [numLookups]
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscAddressDispatcher.h"
+#include "OscRoutingTable.h"
+#include <map>
+#include <iostream>
+#include <new>
+
+//==============================================================================
+static int64 numAllocations = 0;
+
+void* operator new (size_t size)
+{
+    ++numAllocations;
+
+    if (void* p = std::malloc (size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete (void* p) noexcept             { std::free (p); }
+void operator delete (void* p, size_t) noexcept     { std::free (p); }
+
+//==============================================================================
+struct BenchmarkResult
+{
+    double nsPerLookup;
+    int64 allocations;
+    int64 checksum;
+};
+
+template <typename LookupFunction>
+static BenchmarkResult run (const Array<String>& traffic, int numLookups, LookupFunction lookup)
+{
+    BenchmarkResult r = { 0.0, 0, 0 };
+    const int64 allocationsBefore = numAllocations;
+    const int64 start = Time::getHighResolutionTicks();
+
+    for (int i = 0; i < numLookups; ++i)
+        r.checksum += lookup (traffic.getReference (i % traffic.size()));
+
+    const double seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+
+    r.nsPerLookup = seconds * 1.0e9 / numLookups;
+    r.allocations = numAllocations - allocationsBefore;
+    return r;
+}
+
+static void print (const char* name, const BenchmarkResult& r)
+{
+    std::cout << String (name).paddedRight (' ', 24)
+              << String (r.nsPerLookup, 1).paddedLeft (' ', 10) << " ns/lookup"
+              << String (r.allocations).paddedLeft (' ', 12) << " allocations"
+              << "   (checksum " << r.checksum << ")" << std::endl;
+}
+
+// the replies' routes only take whole segments, so "/ctrlFoo" is forwarded to the mixer as before
+static bool checkDefaultRoutes()
+{
+    OscRoutingTable::Ptr table (OscRoutingTable::createDefault());
+
+    const uint32 forwarded = table->findDestinations ("/mixer/module/1");
+    const uint32 reply = table->findDestinations ("/ctrl");
+
+    return reply != forwarded
+        && table->findDestinations ("/ctrl/1") == reply
+        && table->findDestinations ("/ctrlx") == forwarded
+        && table->findDestinations ("/enableX") == forwarded
+        && table->findDestinations ("/enable") == reply;
+}
+
+int main (int argc, char* argv[])
+{
+    if (! checkDefaultRoutes())
+    {
+        std::cout << "default OSC routes don't match on segment boundaries" << std::endl;
+        return 1;
+    }
+
+    const int numParameters = argc > 1 ? jmax (20, atoi (argv[1])) : 2000;
+    const int numLookups    = argc > 2 ? jmax (1, atoi (argv[2])) : 2000000;
+
+    // parameter names the way a Reaktor ensemble exposes them: the controller
+    // addresses somewhere among lots of unrelated panel parameters
+    StringArray parameterNames;
+    Random rng (1234);
+
+    for (int i = 0; i < numParameters; ++i)
+        parameterNames.add ("Panel Param " + String (i));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        parameterNames.set (rng.nextInt (numParameters), "/fader/" + String (i));
+        parameterNames.set (rng.nextInt (numParameters), "/bigButton/" + String (i));
+
+        if (i < 4)
+            parameterNames.set (rng.nextInt (numParameters), "/smallButton/" + String (i));
+    }
+
+    // incoming traffic: mostly faders, with the odd address that doesn't resolve
+    Array<String> traffic;
+
+    for (int i = 0; i < 1024; ++i)
+    {
+        const int n = rng.nextInt (10);
+
+        if (n < 7)       traffic.add ("/module/0/fader/" + String (rng.nextInt (8)));
+        else if (n < 9)  traffic.add ("/module/0/bigButton/" + String (rng.nextInt (8)));
+        else             traffic.add ("/module/0/unknown/" + String (rng.nextInt (8)));
+    }
+
+    std::map<String, int> addressesMap;
+
+    for (int i = parameterNames.size(); --i >= 0;)
+        if (parameterNames[i].startsWithChar ('/'))
+            addressesMap[parameterNames[i]] = i;
+
+    OscAddressDispatcher dispatcher (parameterNames);
+
+    std::cout << numParameters << " parameters, " << numLookups << " lookups" << std::endl;
+
+    print ("std::map + substring", run (traffic, numLookups, [&] (const String& address)
+    {
+        auto it = addressesMap.find (address.substring (9));
+        return it != addressesMap.end() ? it->second : -1;
+    }));
+
+    print ("OscAddressDispatcher", run (traffic, numLookups, [&] (const String& address)
+    {
+        return dispatcher.find (address.toRawUTF8() + 9, address.getNumBytesAsUTF8() - 9);
+    }));
+
+    return 0;
+}
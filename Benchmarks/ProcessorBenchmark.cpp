@@ -0,0 +1,281 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+/*
+    Times ReaktorHostProcessor::processBlock around a stand-in instance (the sine
+    wave synth, plus a configurable amount of busywork per sample) at a range of
+    block sizes, with OSC parameter changes and MIDI notes arriving every block.
+    Reports the wrapper's cost per sample, the 99th percentile and worst block,
+    and how many heap allocations the audio thread made.
+
+    usage: ProcessorBenchmark [secondsPerBlockSize] [oscMessagesPerBlock] [midiEventsPerBlock] [workPerSample]
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "PluginProcessor.h"
+#include "SinewaveSynth.h"
+#include <iostream>
+#include <new>
+
+//==============================================================================
+// only the audio thread's allocations are counted: the processor's own threads
+// are allowed to allocate. HeapBlock, MidiBuffer and Array allocate with malloc
+// and realloc rather than new, so on Linux the malloc family is counted instead
+// of operator new; elsewhere only operator new can be seen.
+static thread_local bool isCountingAllocations = false;
+static int64 numAllocations = 0;
+
+static inline void countAllocation() noexcept
+{
+    if (isCountingAllocations)
+        ++numAllocations;
+}
+
+#if JUCE_LINUX
+ extern "C" void* __libc_malloc (size_t);
+ extern "C" void* __libc_calloc (size_t, size_t);
+ extern "C" void* __libc_realloc (void*, size_t);
+
+ extern "C" void* malloc (size_t size)                  { countAllocation(); return __libc_malloc (size); }
+ extern "C" void* calloc (size_t num, size_t size)      { countAllocation(); return __libc_calloc (num, size); }
+ extern "C" void* realloc (void* p, size_t size)        { countAllocation(); return __libc_realloc (p, size); }
+
+ static const char* const allocationsLabel = " heap allocations";
+#else
+ static const char* const allocationsLabel = " operator new calls";
+#endif
+
+void* operator new (size_t size)
+{
+   #if ! JUCE_LINUX
+    countAllocation();
+   #endif
+
+    if (void* p = std::malloc (size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete (void* p) noexcept             { std::free (p); }
+void operator delete (void* p, size_t) noexcept     { std::free (p); }
+
+//==============================================================================
+/** Stands in for Reaktor: a sine synth with parameters named the way an ensemble's
+    controllers are, and workPerSample multiply-adds per sample on top.
+*/
+class StandInInstance  : public AudioPluginInstance
+{
+public:
+    StandInInstance (int numParameters, int work)
+        : AudioPluginInstance (BusesProperties().withInput  ("Input",  AudioChannelSet::stereo())
+                                                .withOutput ("Output", AudioChannelSet::stereo())),
+          workPerSample (work)
+    {
+        for (int i = 0; i < 8; ++i)
+            synth.addVoice (new SineWaveVoice());
+
+        synth.addSound (new SineWaveSound());
+
+        for (int i = 0; i < numParameters; ++i)
+            addParameter (new AudioParameterFloat ("param" + String (i), i < 8 ? "/fader/" + String (i) : "Panel Param " + String (i), 0.0f, 1.0f, 0.5f));
+    }
+
+    void fillInPluginDescription (PluginDescription& description) const override
+    {
+        description.name = getName();
+        description.descriptiveName = getName();
+        description.pluginFormatName = "Internal";
+        description.manufacturerName = "ReaktorHost";
+        description.fileOrIdentifier = getName();
+        description.uid = getName().hashCode();
+        description.isInstrument = true;
+        description.numInputChannels = getTotalNumInputChannels();
+        description.numOutputChannels = getTotalNumOutputChannels();
+    }
+
+    void prepareToPlay (double sampleRate, int) override    { synth.setCurrentPlaybackSampleRate (sampleRate); }
+    void releaseResources() override                        {}
+
+    void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
+    {
+        buffer.clear();
+        synth.renderNextBlock (buffer, midiMessages, 0, buffer.getNumSamples());
+
+        // the parameters feed the busywork, so their changes can't be optimised away
+        const float gain = getParameters()[0]->getValue();
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            float* samples = buffer.getWritePointer (channel);
+
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+            {
+                float x = samples[i];
+
+                for (int j = 0; j < workPerSample; ++j)
+                    x = x * 0.999f + gain * 1.0e-6f;
+
+                samples[i] = x;
+            }
+        }
+    }
+
+    const String getName() const override                   { return "Benchmark stand-in"; }
+    double getTailLengthSeconds() const override            { return 0; }
+    bool acceptsMidi() const override                       { return true; }
+    bool producesMidi() const override                      { return false; }
+    bool hasEditor() const override                         { return false; }
+    AudioProcessorEditor* createEditor() override           { return nullptr; }
+    int getNumPrograms() override                           { return 1; }
+    int getCurrentProgram() override                        { return 0; }
+    void setCurrentProgram (int) override                   {}
+    const String getProgramName (int) override              { return {}; }
+    void changeProgramName (int, const String&) override    {}
+    void getStateInformation (MemoryBlock&) override        {}
+    void setStateInformation (const void*, int) override    {}
+
+private:
+    Synthesiser synth;
+    const int workPerSample;
+};
+
+//==============================================================================
+struct BenchmarkResult
+{
+    double nsPerSample, p99Microseconds, worstMicroseconds;
+    int64 allocations;
+};
+
+static BenchmarkResult run (ReaktorHostProcessor& processor, double sampleRate, int blockSize, double seconds,
+                            int oscMessagesPerBlock, int midiEventsPerBlock, const StringArray& addresses)
+{
+    processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+    processor.prepareToPlay (sampleRate, blockSize);
+
+    AudioBuffer<float> buffer (jmax (processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels()), blockSize);
+    MidiBuffer midi;
+    midi.ensureSize (4096);
+
+    const int numWarmUpBlocks = 100;
+    const int numBlocks = jmax (100, (int) (seconds * sampleRate / blockSize));
+
+    Array<int64> blockTicks;
+    blockTicks.ensureStorageAllocated (numBlocks);
+
+    Random rng (1234);
+    int note = 0;
+    int64 totalTicks = 0;
+
+    for (int block = -numWarmUpBlocks; block < numBlocks; ++block)
+    {
+        // what would have arrived from the OSC thread during the previous block
+        for (int i = 0; i < oscMessagesPerBlock; ++i)
+        {
+            const String& address = addresses.getReference (rng.nextInt (addresses.size()));
+            processor.setVstCtrl (address.toRawUTF8(), address.getNumBytesAsUTF8(), rng.nextFloat());
+        }
+
+        midi.clear();
+
+        for (int i = 0; i < midiEventsPerBlock; ++i)
+        {
+            const int sample = i * blockSize / jmax (1, midiEventsPerBlock);
+            midi.addEvent ((note & 1) == 0 ? MidiMessage::noteOn (1, 48 + (note / 2) % 24, 0.8f)
+                                           : MidiMessage::noteOff (1, 48 + (note / 2) % 24), sample);
+            ++note;
+        }
+
+        buffer.clear();
+
+        if (block == 0)
+            numAllocations = 0;
+
+        isCountingAllocations = block >= 0;
+        const int64 start = Time::getHighResolutionTicks();
+
+        processor.processBlock (buffer, midi);
+
+        const int64 ticks = Time::getHighResolutionTicks() - start;
+        isCountingAllocations = false;
+
+        if (block >= 0)
+        {
+            blockTicks.add (ticks);
+            totalTicks += ticks;
+        }
+    }
+
+    processor.releaseResources();
+
+    std::sort (blockTicks.begin(), blockTicks.end());
+
+    BenchmarkResult r;
+    r.nsPerSample = Time::highResolutionTicksToSeconds (totalTicks) * 1.0e9 / ((double) numBlocks * blockSize);
+    r.p99Microseconds = Time::highResolutionTicksToSeconds (blockTicks[(int) (numBlocks * 0.99)]) * 1.0e6;
+    r.worstMicroseconds = Time::highResolutionTicksToSeconds (blockTicks.getLast()) * 1.0e6;
+    r.allocations = numAllocations;
+    return r;
+}
+
+int main (int argc, char* argv[])
+{
+    const double seconds          = argc > 1 ? jmax (0.1, atof (argv[1])) : 20.0;
+    const int oscMessagesPerBlock = argc > 2 ? jmax (0, atoi (argv[2])) : 8;
+    const int midiEventsPerBlock  = argc > 3 ? jmax (0, atoi (argv[3])) : 2;
+    const int workPerSample       = argc > 4 ? jmax (0, atoi (argv[4])) : 0;
+
+    ScopedJuceInitialiser_GUI libraryInitialiser;
+
+    const double sampleRate = 44100.0;
+    const int numParameters = 2000;
+
+    ScopedPointer<ReaktorHostProcessor> processor (new ReaktorHostProcessor());
+
+    processor->setRateAndBufferSizeDetails (sampleRate, 512);
+    processor->prepareToPlay (sampleRate, 512);
+    processor->addFilterCallback (new StandInInstance (numParameters, workPerSample), String(), Point<int>());
+
+    StringArray addresses;
+
+    for (int i = 0; i < 8; ++i)
+        addresses.add ("/fader/" + String (i));
+
+    std::cout << seconds << " s of audio per block size, " << oscMessagesPerBlock << " OSC messages and "
+              << midiEventsPerBlock << " MIDI events per block, " << workPerSample << " work per sample" << std::endl;
+
+    const int blockSizes[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+
+    for (int blockSize : blockSizes)
+    {
+        const BenchmarkResult r (run (*processor, sampleRate, blockSize, seconds, oscMessagesPerBlock, midiEventsPerBlock, addresses));
+
+        std::cout << String (blockSize).paddedLeft (' ', 6) << " samples"
+                  << String (r.nsPerSample, 2).paddedLeft (' ', 10) << " ns/sample"
+                  << String (r.p99Microseconds, 1).paddedLeft (' ', 10) << " us p99"
+                  << String (r.worstMicroseconds, 1).paddedLeft (' ', 10) << " us worst"
+                  << String (r.allocations).paddedLeft (' ', 8) << allocationsLabel << std::endl;
+    }
+
+    processor = nullptr;
+    return 0;
+}
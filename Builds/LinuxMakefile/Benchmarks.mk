@@ -0,0 +1,23 @@
+# Benchmark executables, built against the shared-code library of the main Makefile.
+# Kept out of the generated Makefile so re-saving the Projucer project doesn't lose it.
+#
+#   make -f Benchmarks.mk CONFIG=Release
+#   ./build/OscDispatchBenchmark
+#   ./build/ProcessorBenchmark
+
+include Makefile
+
+.DEFAULT_GOAL := Benchmarks
+
+BENCHMARKS := \
+  $(JUCE_OUTDIR)/OscDispatchBenchmark \
+  $(JUCE_OUTDIR)/ProcessorBenchmark \
+
+.PHONY: Benchmarks
+
+Benchmarks : $(BENCHMARKS)
+
+$(JUCE_OUTDIR)/% : ../../Benchmarks/%.cpp $(JUCE_OUTDIR)/$(JUCE_TARGET_SHARED_CODE)
+	-$(V_AT)mkdir -p $(JUCE_OUTDIR)
+	@echo "Linking $*"
+	$(V_AT)$(CXX) $(JUCE_CXXFLAGS) $(JUCE_CPPFLAGS_SHARED_CODE) -I../../Source -o "$@" "$<" $(JUCE_OUTDIR)/$(JUCE_TARGET_SHARED_CODE) $(JUCE_LDFLAGS)
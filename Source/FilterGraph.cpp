@@ -29,11 +29,351 @@
 #include "FilterGraph.h"
 #include "InternalFilters.h"
 #include "GraphEditorPanel.h"
+#include "PluginStateContainer.h"
 
 
 //==============================================================================
 const int FilterGraph::midiChannelNumber = 0x1000;
 
+static void restoreLayout (AudioPluginInstance&, const XmlElement&);
+static void restoreLayoutAndState (AudioPluginInstance&, const XmlElement&, const PluginStateContainer&);
+
+//==============================================================================
+/**
+    The graph document being restored. A binary document's file stays mapped for
+    as long as the loader, or a placeholder that hasn't read its state yet, still
+    refers to it.
+*/
+class GraphDocumentStates  : public PlaceholderProcessor::StateSource
+{
+public:
+    typedef ReferenceCountedObjectPtr<GraphDocumentStates> Ptr;
+
+    GraphDocumentStates (const XmlElement& graphXml, MemoryMappedFile* mappedStateFile)
+        : xml (graphXml), stateFile (mappedStateFile)
+    {
+        // an XML document has its states in it, and reads them from there
+        if (stateFile != nullptr)
+            states.read (stateFile->getData(), stateFile->getSize());
+    }
+
+    bool readState (const XmlElement& stateElement, MemoryBlock& dest) const override
+    {
+        return states.readChunk (stateElement, dest);
+    }
+
+    const PluginStateContainer& getStates() const noexcept  { return states; }
+
+    const XmlElement xml;
+
+private:
+    ScopedPointer<MemoryMappedFile> stateFile;
+    PluginStateContainer states;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GraphDocumentStates)
+};
+
+//==============================================================================
+/**
+    Loads the plugins for a graph's nodes alongside each other, rather than
+    one after another. Every plugin is created asynchronously from the message
+    thread, which is where the formats create them anyway, and each one's state
+    is then restored on a pool of threads as soon as it has been created, so the
+    slow part of loading runs in parallel. The graph gets them all once they're
+    ready, so connections are only made between nodes that exist. A binary
+    document's file stays mapped while they load, and each plugin's state is read
+    from it by the thread that restores it.
+
+    In lazy mode the graph already has a PlaceholderProcessor for each node, and
+    each plugin replaces its placeholder as soon as it's ready. Either way, the
+    nodes closest to the audio output are started first, so the path that's
+    being listened to comes alive first.
+*/
+class FilterGraph::Loader  : private AsyncUpdater
+{
+public:
+    Loader (FilterGraph& g, const XmlElement& graphXml, MemoryMappedFile* mappedStateFile, bool loadsLazily)
+        : owner (g), document (new GraphDocumentStates (graphXml, mappedStateFile)), lazy (loadsLazily),
+          pool (jmax (1, SystemStats::getNumCpus()))
+    {
+        forEachXmlChildElementWithTagName (document->xml, e, "FILTER")
+            nodes.add (new NodeToLoad (*e));
+
+        numNodesPending = nodes.size();
+        sortByPriority();
+    }
+
+    ~Loader()
+    {
+        // the restore jobs that have started can't be interrupted, so this waits for
+        // them (they never need the message thread); instances that are created
+        // afterwards are thrown away
+        pool.removeAllJobs (true, -1);
+        masterReference.clear();
+    }
+
+    //==============================================================================
+    /** Message thread: the owner's addLoadedNodes() is called once every node has
+        been created or has failed to be, and in lazy mode its replacePlaceholder()
+        is called for each one as it's ready.
+    */
+    void start()
+    {
+        startTimeMs = Time::getMillisecondCounterHiRes();
+
+        for (auto* node : loadOrder)
+            owner.formatManager.createPluginInstanceAsync (node->description, owner.graph.getSampleRate(),
+                                                           owner.graph.getBlockSize(), new AsyncCallback (*this, *node));
+
+        if (nodes.isEmpty())
+            triggerAsyncUpdate();
+    }
+
+    /** Message thread: returns once every node has been created or has failed to be.
+        The plugins are created by the message thread, so it keeps dispatching
+        messages while it waits rather than blocking.
+    */
+    void loadAndWait()
+    {
+        isWaiting = true;
+        start();
+
+        while (numNodesPending.get() > 0)
+            MessageManager::getInstance()->runDispatchLoopUntil (10);
+
+        cancelPendingUpdate();
+        isWaiting = false;
+        totalMs = Time::getMillisecondCounterHiRes() - startTimeMs;
+    }
+
+    //==============================================================================
+    struct NodeToLoad
+    {
+        NodeToLoad (const XmlElement& e)  : xml (e)
+        {
+            forEachXmlChildElement (e, child)
+                if (description.loadFromXml (*child))
+                    break;
+        }
+
+        const XmlElement& xml;
+        PluginDescription description;
+        ScopedPointer<AudioPluginInstance> instance;
+        String error;
+        double createMs = 0, restoreMs = 0;
+        int distanceFromOutput = 0;
+        bool wasCreated = false;
+    };
+
+    bool isLazy() const noexcept                        { return lazy; }
+    GraphDocumentStates* getDocument() const noexcept   { return document; }
+    const XmlElement& getXml() const noexcept           { return document->xml; }
+    const OwnedArray<NodeToLoad>& getNodes() const noexcept   { return nodes; }
+
+    String createReport() const
+    {
+        double sumMs = 0;
+
+        for (auto* node : nodes)
+            sumMs += node->createMs + node->restoreMs;
+
+        String report;
+        report << "Loaded " << nodes.size() << " plugins in " << roundToInt (totalMs) << " ms ("
+               << roundToInt (sumMs) << " ms one after another)" << newLine;
+
+        for (auto* node : nodes)
+        {
+            report << "  " << node->description.name << " (node " << node->xml.getIntAttribute ("uid") << "): ";
+
+            if (! node->wasCreated)
+                report << "failed" << (node->error.isNotEmpty() ? ": " + node->error : String());
+            else
+                report << "created in " << roundToInt (node->createMs) << " ms, state restored in "
+                       << roundToInt (node->restoreMs) << " ms";
+
+            report << newLine;
+        }
+
+        return report;
+    }
+
+private:
+    //==============================================================================
+    struct RestoreJob  : public ThreadPoolJob
+    {
+        RestoreJob (Loader& l, NodeToLoad& n)  : ThreadPoolJob ("Restore " + n.description.name), loader (l), node (n) {}
+
+        JobStatus runJob() override
+        {
+            loader.restore (node);
+            return jobHasFinished;
+        }
+
+        Loader& loader;
+        NodeToLoad& node;
+    };
+
+    struct AsyncCallback  : public AudioPluginFormat::InstantiationCompletionCallback
+    {
+        AsyncCallback (Loader& l, NodeToLoad& n)
+            : loader (&l), node (n), startTimeMs (Time::getMillisecondCounterHiRes())
+        {}
+
+        void completionCallback (AudioPluginInstance* instance, const String& error) override
+        {
+            ScopedPointer<AudioPluginInstance> newInstance (instance);
+
+            if (Loader* l = loader.get())
+            {
+                node.createMs = Time::getMillisecondCounterHiRes() - startTimeMs;
+                l->nodeCreated (node, newInstance.release(), error);
+            }
+        }
+
+        WeakReference<Loader> loader;
+        NodeToLoad& node;
+        double startTimeMs;
+    };
+
+    FilterGraph& owner;
+    GraphDocumentStates::Ptr document;
+    const bool lazy;
+    OwnedArray<NodeToLoad> nodes;
+    Array<NodeToLoad*> loadOrder;
+    ThreadPool pool;
+    Atomic<int> numNodesPending;
+    bool isWaiting = false;
+
+    // the nodes whose placeholders are waiting to be replaced, in lazy mode
+    CriticalSection readyLock;
+    Array<NodeToLoad*> readyNodes;
+    double startTimeMs = 0, totalMs = 0;
+
+    WeakReference<Loader>::Master masterReference;
+    friend class WeakReference<Loader>;
+
+    struct PriorityComparator
+    {
+        static int compareElements (const NodeToLoad* first, const NodeToLoad* second) noexcept
+        {
+            return first->distanceFromOutput - second->distanceFromOutput;
+        }
+    };
+
+    // counts the connections from each node to the audio output; nodes that don't
+    // reach it go last, and otherwise the document's order is kept
+    void sortByPriority()
+    {
+        const String audioOutputName (InternalPluginFormat().audioOutDesc.name);
+        const int unreachable = std::numeric_limits<int>::max();
+
+        Array<uint32> uids;
+        Array<NodeToLoad*> toVisit;
+
+        for (auto* node : nodes)
+        {
+            uids.add ((uint32) node->xml.getIntAttribute ("uid"));
+
+            if (node->description.name == audioOutputName)
+                toVisit.add (node);
+            else
+                node->distanceFromOutput = unreachable;
+        }
+
+        for (int i = 0; i < toVisit.size(); ++i)
+        {
+            NodeToLoad* const dest = toVisit.getUnchecked (i);
+            const int destUid = dest->xml.getIntAttribute ("uid");
+
+            forEachXmlChildElementWithTagName (document->xml, e, "CONNECTION")
+            {
+                if (e->getIntAttribute ("dstFilter") != destUid)
+                    continue;
+
+                if (NodeToLoad* source = nodes[uids.indexOf ((uint32) e->getIntAttribute ("srcFilter"))])
+                {
+                    if (source->distanceFromOutput == unreachable)
+                    {
+                        source->distanceFromOutput = dest->distanceFromOutput + 1;
+                        toVisit.add (source);
+                    }
+                }
+            }
+        }
+
+        loadOrder.addArray (nodes.begin(), nodes.size());
+
+        PriorityComparator comparator;
+        loadOrder.sort (comparator, true);
+    }
+
+    // message thread: the state is restored on the pool, which never waits for it
+    void nodeCreated (NodeToLoad& node, AudioPluginInstance* instance, const String& error)
+    {
+        node.instance = instance;
+        node.error = error;
+        node.wasCreated = instance != nullptr;
+
+        if (instance != nullptr)
+            pool.addJob (new RestoreJob (*this, node), true);
+        else
+            nodeFinished (node);
+    }
+
+    // called on a pool thread
+    void restore (NodeToLoad& node)
+    {
+        const double restoreStartMs = Time::getMillisecondCounterHiRes();
+        restoreLayoutAndState (*node.instance, node.xml, document->getStates());
+        node.restoreMs = Time::getMillisecondCounterHiRes() - restoreStartMs;
+
+        if (lazy)
+        {
+            const ScopedLock sl (readyLock);
+            readyNodes.add (&node);
+        }
+
+        nodeFinished (node);
+    }
+
+    void nodeFinished (const NodeToLoad& node)
+    {
+        if (--numNodesPending == 0 || (lazy && node.wasCreated))
+            triggerAsyncUpdate();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        // loadAndWait() hands the nodes over itself
+        if (isWaiting)
+            return;
+
+        // checked first: a node that's ready after this has another update coming
+        const bool allDone = numNodesPending.get() == 0;
+
+        Array<NodeToLoad*> nodesToReplace;
+
+        {
+            const ScopedLock sl (readyLock);
+            nodesToReplace.swapWith (readyNodes);
+        }
+
+        for (auto* node : nodesToReplace)
+            owner.replacePlaceholder (node->instance.release(), node->xml);
+
+        if (allDone)
+        {
+            totalMs = Time::getMillisecondCounterHiRes() - startTimeMs;
+
+            // this deletes the loader, so it's the last thing it does
+            owner.addLoadedNodes (*this);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Loader)
+};
+
+//==============================================================================
 FilterGraph::FilterGraph (AudioPluginFormatManager& fm)
     : FileBasedDocument (filenameSuffix,
                          filenameWildcard,
@@ -54,6 +394,8 @@ FilterGraph::FilterGraph (AudioPluginFormatManager& fm)
 
 FilterGraph::~FilterGraph()
 {
+    loader = nullptr;
+
     graph.addListener (this);
     graph.clear();
 }
@@ -221,6 +563,9 @@ void FilterGraph::removeConnection (uint32 sourceFilterUID, int sourceFilterChan
 
 void FilterGraph::clear()
 {
+    // a graph that's still loading is abandoned
+    loader = nullptr;
+
     PluginWindow::closeAllCurrentlyOpenWindows();
 
     graph.clear();
@@ -240,6 +585,7 @@ void FilterGraph::newDocument()
 {
     clear();
     setFile ({});
+    savesBinary = newDocumentsSaveBinary;
 
     InternalPluginFormat internalFormat;
 
@@ -252,18 +598,66 @@ void FilterGraph::newDocument()
 
 Result FilterGraph::loadDocument (const File& file)
 {
+    // the binary format only has its XML read now, and the states as the plugins need them
+    ScopedPointer<MemoryMappedFile> mappedFile (new MemoryMappedFile (file, MemoryMappedFile::readOnly));
+
+    if (mappedFile->getData() != nullptr && PluginStateContainer::isContainer (mappedFile->getData(), mappedFile->getSize()))
+    {
+        PluginStateContainer container;
+        ScopedPointer<XmlElement> xml;
+
+        if (container.read (mappedFile->getData(), mappedFile->getSize()))
+            xml = container.createXml();
+
+        if (xml == nullptr || ! xml->hasTagName ("FILTERGRAPH"))
+            return Result::fail ("Not a valid filter graph file");
+
+        savesBinary = true;
+        restoreGraph (*xml, mappedFile.release());
+        return Result::ok();
+    }
+
+    mappedFile = nullptr;
+
     XmlDocument doc (file);
     ScopedPointer<XmlElement> xml (doc.getDocumentElement());
 
     if (xml == nullptr || ! xml->hasTagName ("FILTERGRAPH"))
         return Result::fail ("Not a valid filter graph file");
 
+    savesBinary = false;
     restoreFromXml (*xml);
     return Result::ok();
 }
 
 Result FilterGraph::saveDocument (const File& file)
 {
+    if (savesBinary)
+    {
+        PluginStateContainer container;
+        ScopedPointer<XmlElement> xml (createXml (&container));
+
+        // the file being replaced may be mapped by a graph that's still loading from it
+        TemporaryFile tempFile (file);
+
+        {
+            FileOutputStream out (tempFile.getFile());
+
+            if (! out.openedOk())
+                return Result::fail ("Couldn't write to the file");
+
+            container.write (*xml, out, PluginStateContainer::stored);
+
+            if (out.getStatus().failed())
+                return Result::fail ("Couldn't write to the file");
+        }
+
+        if (! tempFile.overwriteTargetFileWithTemporary())
+            return Result::fail ("Couldn't write to the file");
+
+        return Result::ok();
+    }
+
     ScopedPointer<XmlElement> xml (createXml());
 
     if (! xml->writeToFile (file, String()))
@@ -355,7 +749,7 @@ static XmlElement* createBusLayoutXml (const AudioProcessor::BusesLayout& layout
     return xml;
 }
 
-static XmlElement* createNodeXml (AudioProcessorGraph::Node* const node) noexcept
+static XmlElement* createNodeXml (AudioProcessorGraph::Node* const node, PluginStateContainer* stateChunks) noexcept
 {
     AudioPluginInstance* plugin = dynamic_cast<AudioPluginInstance*> (node->getProcessor());
 
@@ -391,7 +785,12 @@ static XmlElement* createNodeXml (AudioProcessorGraph::Node* const node) noexcep
 
     MemoryBlock m;
     node->getProcessor()->getStateInformation (m);
-    state->addTextElement (m.toBase64Encoding());
+
+    if (stateChunks != nullptr)
+        stateChunks->storeChunk (*state, static_cast<MemoryBlock&&> (m));
+    else
+        state->addTextElement (m.toBase64Encoding());
+
     e->addChildElement (state);
 
     XmlElement* layouts = new XmlElement ("LAYOUT");
@@ -406,42 +805,44 @@ static XmlElement* createNodeXml (AudioProcessorGraph::Node* const node) noexcep
     return e;
 }
 
-void FilterGraph::createNodeFromXml (const XmlElement& xml)
+static void restoreLayout (AudioPluginInstance& instance, const XmlElement& xml)
 {
-    PluginDescription pd;
-
-    forEachXmlChildElement (xml, e)
-    {
-        if (pd.loadFromXml (*e))
-            break;
-    }
-
-    String errorMessage;
-
-    AudioPluginInstance* instance = formatManager.createPluginInstance (pd, graph.getSampleRate(), graph.getBlockSize(), errorMessage);
-
-    if (instance == nullptr)
-        return;
-
     if (const XmlElement* const layoutEntity = xml.getChildByName ("LAYOUT"))
     {
-        AudioProcessor::BusesLayout layout = instance->getBusesLayout();
+        AudioProcessor::BusesLayout layout = instance.getBusesLayout();
 
         const bool isInputChoices[] = { true, false };
         for (bool isInput : isInputChoices)
-            readBusLayoutFromXml (layout, instance, *layoutEntity, isInput);
+            readBusLayoutFromXml (layout, &instance, *layoutEntity, isInput);
 
-        instance->setBusesLayout (layout);
+        instance.setBusesLayout (layout);
     }
+}
 
-    AudioProcessorGraph::Node::Ptr node (graph.addNode (instance, (uint32) xml.getIntAttribute ("uid")));
+// the state is a chunk in a binary document, or base64 in an XML one
+static void restoreLayoutAndState (AudioPluginInstance& instance, const XmlElement& xml, const PluginStateContainer& states)
+{
+    restoreLayout (instance, xml);
 
     if (const XmlElement* const state = xml.getChildByName ("STATE"))
     {
         MemoryBlock m;
-        m.fromBase64Encoding (state->getAllSubText());
+        states.readChunk (*state, m);
 
-        node->getProcessor()->setStateInformation (m.getData(), (int) m.getSize());
+        instance.setStateInformation (m.getData(), (int) m.getSize());
+    }
+}
+
+// the instance has already had its layout and state restored
+void FilterGraph::addNodeFromXml (AudioPluginInstance* instance, const XmlElement& xml)
+{
+    AudioProcessorGraph::Node::Ptr node (graph.addNode (instance, (uint32) xml.getIntAttribute ("uid")));
+
+    // two nodes in the document with the same id
+    if (node == nullptr)
+    {
+        delete instance;
+        return;
     }
 
     node->properties.set ("x", xml.getDoubleAttribute ("x"));
@@ -457,7 +858,9 @@ void FilterGraph::createNodeFromXml (const XmlElement& xml)
             node->properties.set (getLastYProp (type), xml.getIntAttribute (getLastYProp (type)));
             node->properties.set (getOpenProp (type), xml.getIntAttribute (getOpenProp (type)));
 
-            if (node->properties[getOpenProp (type)])
+            // a placeholder's windows are opened once its plugin replaces it
+            if (restoresPluginWindows && node->properties[getOpenProp (type)]
+                 && dynamic_cast<PlaceholderProcessor*> (instance) == nullptr)
             {
                 jassert (node->getProcessor() != nullptr);
 
@@ -468,12 +871,12 @@ void FilterGraph::createNodeFromXml (const XmlElement& xml)
     }
 }
 
-XmlElement* FilterGraph::createXml() const
+XmlElement* FilterGraph::createXml (PluginStateContainer* stateChunks) const
 {
     XmlElement* xml = new XmlElement ("FILTERGRAPH");
 
     for (int i = 0; i < graph.getNumNodes(); ++i)
-        xml->addChildElement (createNodeXml (graph.getNode (i)));
+        xml->addChildElement (createNodeXml (graph.getNode (i), stateChunks));
 
     for (int i = 0; i < graph.getNumConnections(); ++i)
     {
@@ -494,14 +897,49 @@ XmlElement* FilterGraph::createXml() const
 
 void FilterGraph::restoreFromXml (const XmlElement& xml)
 {
+    restoreGraph (xml, nullptr);
+}
+
+// a binary document's mapped file belongs to the loader from here
+void FilterGraph::restoreGraph (const XmlElement& xml, MemoryMappedFile* stateFile)
+{
+    ScopedPointer<MemoryMappedFile> file (stateFile);
     clear();
 
-    forEachXmlChildElementWithTagName (xml, e, "FILTER")
+    const bool lazy = loadsLazily && ! waitsForPluginsToLoad;
+    loader = new Loader (*this, xml, file.release(), lazy);
+
+    if (waitsForPluginsToLoad)
     {
-        createNodeFromXml (*e);
-        changed();
+        loader->loadAndWait();
+        addLoadedNodes (*loader);
+        return;
+    }
+
+    // the whole graph can be seen, edited and played straight away; the states
+    // are only read by placeholders that are saved before their plugins arrive
+    if (lazy)
+    {
+        for (auto* node : loader->getNodes())
+        {
+            PlaceholderProcessor* placeholder = new PlaceholderProcessor (node->description);
+            restoreLayout (*placeholder, node->xml);
+
+            if (const XmlElement* const state = node->xml.getChildByName ("STATE"))
+                placeholder->setStateSource (loader->getDocument(), *state);
+
+            addNodeFromXml (placeholder, node->xml);
+        }
+
+        addConnectionsFromXml (xml);
+        setChangedFlag (false);
     }
 
+    loader->start();
+}
+
+void FilterGraph::addConnectionsFromXml (const XmlElement& xml)
+{
     forEachXmlChildElementWithTagName (xml, e, "CONNECTION")
     {
         addConnection ((uint32) e->getIntAttribute ("srcFilter"),
@@ -509,6 +947,85 @@ void FilterGraph::restoreFromXml (const XmlElement& xml)
                        (uint32) e->getIntAttribute ("dstFilter"),
                        e->getIntAttribute ("dstChannel"));
     }
+}
+
+// the node keeps its connections, and wherever it has been moved to meanwhile
+void FilterGraph::replacePlaceholder (AudioPluginInstance* instance, const XmlElement& xml)
+{
+    ScopedPointer<AudioPluginInstance> newInstance (instance);
+    const uint32 uid = (uint32) xml.getIntAttribute ("uid");
+    AudioProcessorGraph::Node::Ptr placeholder (graph.getNodeForId (uid));
+
+    // deleted while its plugin was loading
+    if (placeholder == nullptr || dynamic_cast<PlaceholderProcessor*> (placeholder->getProcessor()) == nullptr)
+        return;
+
+    const bool wasChanged = hasChangedSinceSaved();
+    const NamedValueSet properties (placeholder->properties);
+    Array<AudioProcessorGraph::Connection> connections;
+
+    for (int i = 0; i < graph.getNumConnections(); ++i)
+    {
+        const AudioProcessorGraph::Connection* c = graph.getConnection (i);
+
+        if (c->sourceNodeId == uid || c->destNodeId == uid)
+            connections.add (*c);
+    }
+
+    placeholder = nullptr;
+    graph.removeNode (uid);
+    addNodeFromXml (newInstance.release(), xml);
+
+    if (auto node = graph.getNodeForId (uid))
+    {
+        node->properties.set ("x", properties["x"]);
+        node->properties.set ("y", properties["y"]);
+    }
+
+    for (auto& c : connections)
+        graph.addConnection (c.sourceNodeId, c.sourceChannelIndex, c.destNodeId, c.destChannelIndex);
+
+    changed();
+
+    if (! wasChanged)
+        setChangedFlag (false);
+}
+
+// the connections are only made once every node that could be created has been;
+// in lazy mode they're already there, and the nodes have replaced their placeholders
+void FilterGraph::addLoadedNodes (Loader& finishedLoader)
+{
+    jassert (&finishedLoader == loader.get());
+
+    // a document that has just been loaded hasn't been changed
+    const bool wasChanged = hasChangedSinceSaved();
+
+    if (! finishedLoader.isLazy())
+    {
+        for (auto* node : finishedLoader.getNodes())
+            if (node->instance != nullptr)
+                addNodeFromXml (node->instance.release(), node->xml);
+
+        addConnectionsFromXml (finishedLoader.getXml());
+    }
+    else
+    {
+        for (auto* node : finishedLoader.getNodes())
+            if (! node->wasCreated)
+                if (auto placeholderNode = graph.getNodeForId ((uint32) node->xml.getIntAttribute ("uid")))
+                    if (auto* placeholder = dynamic_cast<PlaceholderProcessor*> (placeholderNode->getProcessor()))
+                        placeholder->setFailedToLoad();
+    }
 
     graph.removeIllegalConnections();
+
+    lastLoadReport = finishedLoader.createReport();
+    Logger::writeToLog (lastLoadReport);
+
+    loader = nullptr;
+
+    changed();
+
+    if (! wasChanged)
+        setChangedFlag (false);
 }
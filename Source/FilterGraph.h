@@ -28,6 +28,7 @@
 
 class FilterInGraph;
 class FilterGraph;
+class PluginStateContainer;
 
 const char* const filenameSuffix = ".filtergraph";
 const char* const filenameWildcard = "*.filtergraph";
@@ -90,9 +91,49 @@ public:
     void audioProcessorChanged (AudioProcessor*) override { changed(); }
 
     //==============================================================================
-    XmlElement* createXml() const;
+    /** With a container, the plugin states are added to it as chunks instead of
+        being written into the XML as base64.
+    */
+    XmlElement* createXml (PluginStateContainer* stateChunks = nullptr) const;
     void restoreFromXml (const XmlElement& xml);
 
+    /** Whether the current document, and new ones, are saved in the binary format:
+        the graph as XML, followed by each plugin's state as a chunk of its own.
+        Loading one maps the file into memory and only reads the XML, so a state is
+        only read when its plugin is restored. Both formats can always be loaded, and
+        a document that's opened is saved again in the format it was opened in.
+    */
+    void setSavesBinary (bool shouldSaveBinary) noexcept            { savesBinary = newDocumentsSaveBinary = shouldSaveBinary; }
+
+    /** True if the current document will be saved in the binary format. */
+    bool savesBinaryDocument() const noexcept                       { return savesBinary; }
+
+    /** When false, restoring a graph doesn't reopen the plugin windows that were
+        open when it was saved. Headless renders have no display to open them on.
+    */
+    void setRestoresPluginWindows (bool shouldRestore) noexcept     { restoresPluginWindows = shouldRestore; }
+
+    /** The plugins in a graph being restored are created alongside each other, and
+        added to it once they've all been. Normally restoreFromXml() returns straight
+        away and that happens later; when this is true, it waits for them, and plugins
+        that can only be created asynchronously on the message thread fail to load.
+    */
+    void setWaitsForPluginsToLoad (bool shouldWait) noexcept        { waitsForPluginsToLoad = shouldWait; }
+
+    /** In lazy mode, a graph being restored is shown and played straight away, with
+        a silent PlaceholderProcessor standing in for each plugin until it has been
+        created and its state restored. Ignored while waiting for plugins to load.
+    */
+    void setLoadsLazily (bool shouldLoadLazily) noexcept            { loadsLazily = shouldLoadLazily; }
+
+    /** True while the plugins of a graph being restored are still being created. */
+    bool isLoading() const noexcept                                 { return loader != nullptr; }
+
+    /** How long each plugin in the last graph restored took to create and to have
+        its state restored, and how long they all took together.
+    */
+    String getLastLoadReport() const                                { return lastLoadReport; }
+
     //==============================================================================
     void newDocument();
     String getDocumentTitle() override;
@@ -114,9 +155,22 @@ private:
     AudioProcessorGraph graph;
 
     uint32 lastUID = 0;
+    bool restoresPluginWindows = true;
+    bool waitsForPluginsToLoad = false;
+    bool loadsLazily = false;
+    bool savesBinary = true, newDocumentsSaveBinary = true;
     uint32 getNextUID() noexcept;
 
-    void createNodeFromXml (const XmlElement& xml);
+    class Loader;
+    friend class Loader;
+    ScopedPointer<Loader> loader;
+    String lastLoadReport;
+
+    void restoreGraph (const XmlElement& xml, MemoryMappedFile* stateFile);
+    void addLoadedNodes (Loader&);
+    void replacePlaceholder (AudioPluginInstance*, const XmlElement& xml);
+    void addNodeFromXml (AudioPluginInstance*, const XmlElement& xml);
+    void addConnectionsFromXml (const XmlElement& xml);
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FilterGraph)
 };
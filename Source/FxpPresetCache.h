@@ -0,0 +1,254 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <map>
+
+
+//==============================================================================
+/** An .fxp file that has been read into memory and checked. */
+struct FxpPreset  : public ReferenceCountedObject
+{
+    typedef ReferenceCountedObjectPtr<FxpPreset> Ptr;
+
+    String name;
+    MemoryBlock data;
+
+    /** Checks the header of an .fxp: either a parameter list ('FxCk') or an opaque chunk ('FPCh'). */
+    static bool isValidFxp (const MemoryBlock& mb)
+    {
+        if (mb.getSize() < 56)
+            return false;
+
+        const char* d = static_cast<const char*> (mb.getData());
+
+        if (ByteOrder::bigEndianInt (d) != ByteOrder::bigEndianInt ("CcnK"))
+            return false;
+
+        const uint32 fxMagic = ByteOrder::bigEndianInt (d + 8);
+
+        if (fxMagic == ByteOrder::bigEndianInt ("FPCh"))
+            return mb.getSize() >= 60 && 60 + (size_t) ByteOrder::bigEndianInt (d + 56) <= mb.getSize();
+
+        return fxMagic == ByteOrder::bigEndianInt ("FxCk");
+    }
+
+    /** Reads and checks a file, returning nullptr if it isn't a usable .fxp. */
+    static Ptr readFromFile (const String& name, const File& file)
+    {
+        Ptr preset (new FxpPreset());
+        preset->name = name;
+
+        if (file.loadFileAsData (preset->data) && isValidFxp (preset->data))
+            return preset;
+
+        return nullptr;
+    }
+};
+
+//==============================================================================
+/**
+    Keeps the raw contents of .fxp presets in memory, so that loading one during
+    a show doesn't touch the disk.
+
+    Presets can be preloaded (a whole folder, or a list of names); anything else
+    is read on first use and kept. checkForChangedFiles() drops or re-reads
+    entries whose file has changed on disk, and picks up new files when the whole
+    folder was preloaded.
+*/
+class FxpPresetCache
+{
+public:
+    FxpPresetCache() {}
+
+    void setFolder (const File& newFolder)
+    {
+        const ScopedLock sl (lock);
+
+        if (folder != newFolder)
+        {
+            folder = newFolder;
+            entries.clear();
+            isFolderPreloaded = false;
+        }
+    }
+
+    File getFolder() const
+    {
+        const ScopedLock sl (lock);
+        return folder;
+    }
+
+    /** Returns a preset from memory, or reads it from disk (and keeps it) on a miss. */
+    FxpPreset::Ptr getPreset (const String& name)
+    {
+        File file;
+
+        {
+            const ScopedLock sl (lock);
+            auto it = entries.find (name);
+
+            if (it != entries.end())
+            {
+                ++numHits;
+                return it->second.preset;
+            }
+
+            ++numMisses;
+            file = getFileFor (name);
+        }
+
+        return readAndStore (name, file);
+    }
+
+    /** Reads every .fxp in the folder. Call on a background thread. */
+    void preloadFolder()
+    {
+        Array<File> files;
+        getFolder().findChildFiles (files, File::findFiles, false, "*.fxp");
+
+        for (auto& f : files)
+            readAndStore (f.getFileNameWithoutExtension(), f);
+
+        const ScopedLock sl (lock);
+        isFolderPreloaded = true;
+    }
+
+    /** Reads the named presets. Call on a background thread. */
+    void preload (const StringArray& names)
+    {
+        for (auto& name : names)
+            readAndStore (name, getFolder().getChildFile (name + ".fxp"));
+    }
+
+    /** Re-reads entries whose file has changed, and drops those that have gone. */
+    void checkForChangedFiles()
+    {
+        StringArray changed, removed;
+        bool shouldLookForNewFiles;
+
+        {
+            const ScopedLock sl (lock);
+            shouldLookForNewFiles = isFolderPreloaded;
+
+            for (auto& e : entries)
+            {
+                const File f (getFileFor (e.first));
+
+                if (! f.existsAsFile())
+                    removed.add (e.first);
+                else if (f.getLastModificationTime() != e.second.modificationTime || f.getSize() != e.second.fileSize)
+                    changed.add (e.first);
+            }
+
+            for (auto& name : removed)
+                entries.erase (name);
+        }
+
+        for (auto& name : changed)
+            readAndStore (name, getFolder().getChildFile (name + ".fxp"));
+
+        if (shouldLookForNewFiles)
+        {
+            Array<File> files;
+            getFolder().findChildFiles (files, File::findFiles, false, "*.fxp");
+
+            for (auto& f : files)
+            {
+                const String name (f.getFileNameWithoutExtension());
+                bool isKnown;
+
+                {
+                    const ScopedLock sl (lock);
+                    isKnown = entries.find (name) != entries.end();
+                }
+
+                if (! isKnown)
+                    readAndStore (name, f);
+            }
+        }
+    }
+
+    void clear()
+    {
+        const ScopedLock sl (lock);
+        entries.clear();
+        isFolderPreloaded = false;
+    }
+
+    int getNumHits() const noexcept         { return numHits.get(); }
+    int getNumMisses() const noexcept       { return numMisses.get(); }
+
+    int getNumEntries() const
+    {
+        const ScopedLock sl (lock);
+        return (int) entries.size();
+    }
+
+    int64 getTotalBytes() const
+    {
+        const ScopedLock sl (lock);
+        int64 total = 0;
+
+        for (auto& e : entries)
+            total += (int64) e.second.preset->data.getSize();
+
+        return total;
+    }
+
+private:
+    struct Entry
+    {
+        FxpPreset::Ptr preset;
+        Time modificationTime;
+        int64 fileSize;
+    };
+
+    CriticalSection lock;
+    File folder;
+    std::map<String, Entry> entries;
+    bool isFolderPreloaded = false;
+    Atomic<int> numHits, numMisses;
+
+    File getFileFor (const String& name) const     { return folder.getChildFile (name + ".fxp"); }
+
+    // the file is read outside the lock, so lookups for other presets aren't held up
+    FxpPreset::Ptr readAndStore (const String& name, const File& file)
+    {
+        const Time modificationTime (file.getLastModificationTime());
+        const int64 fileSize = file.getSize();
+
+        FxpPreset::Ptr preset (FxpPreset::readFromFile (name, file));
+
+        const ScopedLock sl (lock);
+
+        if (preset == nullptr)
+            entries.erase (name);
+        else
+            entries[name] = { preset, modificationTime, fileSize };
+
+        return preset;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FxpPresetCache)
+};
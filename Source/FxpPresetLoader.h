@@ -0,0 +1,175 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "FxpPresetCache.h"
+
+
+//==============================================================================
+/**
+    Fetches .fxp presets on a background thread, from its FxpPresetCache or from
+    disk, then hands them to a Target that applies them at a safe point.
+
+    Requests never block the caller. If several loads arrive while one is being
+    applied, only the most recent is loaded next: during a show the last cue
+    is the one that matters. Switches to a standby instance are cues too, and
+    go through the same thread so that only one fade runs at a time.
+
+    While idle, the thread checks the preset folder once a second so the cache
+    notices presets being edited or replaced.
+*/
+class FxpPresetLoader  : private Thread
+{
+public:
+    struct Target
+    {
+        virtual ~Target() {}
+
+        /** Called on the loader thread with a preset that has been read and checked.
+            dueTimeMs is when it should take effect, in Time::getMillisecondCounterHiRes()
+            terms, or 0 for straight away.
+        */
+        virtual void applyPreset (const FxpPreset&, double dueTimeMs) = 0;
+
+        /** Called on the loader thread to make a standby instance the playing one. */
+        virtual void applyStandbySwitch (int slotIndex, double dueTimeMs) = 0;
+    };
+
+    FxpPresetLoader (Target& t)
+        : Thread ("FXP preset loader"), target (t)
+    {
+        startThread();
+    }
+
+    ~FxpPresetLoader()
+    {
+        stop();
+    }
+
+    /** Waits for any preset being applied, then stops the thread for good. */
+    void stop()
+    {
+        stopThread (4000);
+    }
+
+    FxpPresetCache& getCache() noexcept     { return cache; }
+
+    void loadAsync (const String& name, double dueTimeMs = 0.0)
+    {
+        {
+            const ScopedLock sl (lock);
+            pendingLoad = name;
+            pendingSwitch = -1;
+            pendingLoadDueTimeMs = dueTimeMs;
+        }
+
+        notify();
+    }
+
+    void switchAsync (int slotIndex, double dueTimeMs = 0.0)
+    {
+        {
+            const ScopedLock sl (lock);
+            pendingLoad = String();
+            pendingSwitch = slotIndex;
+            pendingLoadDueTimeMs = dueTimeMs;
+        }
+
+        notify();
+    }
+
+    /** Reads the named presets into the cache, or the whole folder if names is empty. */
+    void preloadAsync (const StringArray& names)
+    {
+        {
+            const ScopedLock sl (lock);
+
+            if (names.isEmpty())
+                shouldPreloadFolder = true;
+            else
+                pendingPreloads.addArray (names);
+        }
+
+        notify();
+    }
+
+private:
+    Target& target;
+    FxpPresetCache cache;
+
+    CriticalSection lock;
+    String pendingLoad;
+    int pendingSwitch = -1;
+    double pendingLoadDueTimeMs = 0.0;
+    StringArray pendingPreloads;
+    bool shouldPreloadFolder = false;
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            String name;
+            StringArray preloads;
+            bool preloadFolder;
+            int slotIndex;
+            double dueTimeMs;
+
+            {
+                const ScopedLock sl (lock);
+                name.swapWith (pendingLoad);
+                slotIndex = pendingSwitch;
+                pendingSwitch = -1;
+                dueTimeMs = pendingLoadDueTimeMs;
+                preloads.swapWith (pendingPreloads);
+                preloadFolder = shouldPreloadFolder;
+                shouldPreloadFolder = false;
+            }
+
+            // a load always goes first, so a cue isn't held up behind a preload
+            if (name.isNotEmpty() || slotIndex >= 0)
+            {
+                if (slotIndex >= 0)
+                    target.applyStandbySwitch (slotIndex, dueTimeMs);
+                else if (FxpPreset::Ptr preset = cache.getPreset (name))
+                    target.applyPreset (*preset, dueTimeMs);
+
+                // put back anything taken along with it
+                const ScopedLock sl (lock);
+                pendingPreloads.addArray (preloads);
+                shouldPreloadFolder = shouldPreloadFolder || preloadFolder;
+                continue;
+            }
+
+            if (preloadFolder)
+                cache.preloadFolder();
+
+            if (preloads.size() > 0)
+                cache.preload (preloads);
+
+            if (! preloadFolder && preloads.isEmpty() && ! wait (1000))
+                cache.checkForChangedFiles();
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FxpPresetLoader)
+};
@@ -332,9 +332,17 @@ struct FilterComponent   : public Component
             m.addItem (6, "Configure Audio I/O");
             m.addItem (7, "Test state save/load");
 
+            if (getGraphPanel()->showsLoadOverlay())
+                m.addItem (8, "Reset DSP load figures");
+
             auto r = m.show();
 
-            if (r == 1)
+            if (r == 8)
+            {
+                if (auto stats = getGraphPanel()->getLoadStatsFor (pluginID))
+                    stats->reset();
+            }
+            else if (r == 1)
             {
                 graph.removeFilter (pluginID);
                 return;
@@ -429,9 +437,33 @@ struct FilterComponent   : public Component
 
         g.fillRect (x, y, w, h);
 
+        auto textArea = getLocalBounds().reduced (4, 2);
+
+        if (auto stats = getGraphPanel()->getLoadStatsFor (pluginID))
+        {
+            const NodeLoadStats::Snapshot s (stats->getSnapshot());
+            auto loadArea = Rectangle<int> (x, y, w, h).removeFromBottom (loadHeight);
+
+            // green while the worst block fits comfortably, red once one has overrun
+            const Colour barColour (s.worstPercent >= 100.0 ? Colours::red
+                                      : s.worstPercent >= 50.0 ? Colours::orange
+                                                               : Colours::green);
+
+            g.setColour (barColour.withAlpha (0.35f));
+            g.fillRect (loadArea.withWidth (roundToInt (loadArea.getWidth() * jmin (1.0, s.averagePercent / 100.0))));
+
+            g.setColour (findColour (TextEditor::textColourId));
+            g.setFont (Font (11.0f));
+            g.drawFittedText ("avg " + String (s.averagePercent, 1) + "%  worst " + String (s.worstPercent, 1) + "%"
+                                + (s.numOverruns > 0 ? "  xruns " + String (s.numOverruns) : String()),
+                              loadArea.reduced (2, 0), Justification::centred, 1);
+
+            textArea.removeFromBottom (loadHeight);
+        }
+
         g.setColour (findColour (TextEditor::textColourId));
         g.setFont (font);
-        g.drawFittedText (getName(), getLocalBounds().reduced (4, 2), Justification::centred, 2);
+        g.drawFittedText (getName(), textArea, Justification::centred, 2);
     }
 
     void resized() override
@@ -501,6 +533,9 @@ struct FilterComponent   : public Component
         if (textWidth > 300)
             h = 100;
 
+        if (getGraphPanel()->showsLoadOverlay())
+            h += loadHeight;
+
         setSize (w, h);
 
         setName (f->getProcessor()->getName());
@@ -543,6 +578,7 @@ struct FilterComponent   : public Component
     const uint32 pluginID;
     int numInputs = 0, numOutputs = 0;
     int pinSize = 16;
+    const int loadHeight = 14;
     Point<int> originalPos;
     Font font { 13.0f, Font::bold };
     int numIns = 0, numOuts = 0;
@@ -774,6 +810,40 @@ GraphEditorPanel::~GraphEditorPanel()
     deleteAllChildren();
 }
 
+void GraphEditorPanel::setLoadProfiler (NodeLoadProfiler* newProfiler)
+{
+    loadProfiler = newProfiler;
+    repaint();
+}
+
+void GraphEditorPanel::setShowsLoadOverlay (bool shouldShow)
+{
+    loadOverlayShown = shouldShow;
+
+    if (shouldShow)
+        startTimerHz (10);
+    else
+        stopTimer();
+
+    updateComponents();
+    repaint();
+}
+
+NodeLoadStats::Ptr GraphEditorPanel::getLoadStatsFor (uint32 filterID) const
+{
+    if (loadOverlayShown && loadProfiler != nullptr)
+        return loadProfiler->findStatsFor (filterID);
+
+    return nullptr;
+}
+
+void GraphEditorPanel::timerCallback()
+{
+    for (auto* child : getChildren())
+        if (auto* fc = dynamic_cast<FilterComponent*> (child))
+            fc->repaint();
+}
+
 void GraphEditorPanel::paint (Graphics& g)
 {
     g.fillAll (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
@@ -1041,11 +1111,17 @@ GraphDocumentComponent::GraphDocumentComponent (AudioPluginFormatManager& fm, Au
 //      graphPlayer (getAppProperties().getUserSettings()->getBoolValue ("doublePrecisionProcessing", false))
     , graphPlayer (false)
 {
+    graph->setLoadsLazily (MainHostWindow::isLoadingGraphsLazily());
+    graph->setSavesBinary (MainHostWindow::isSavingGraphsAsBinary());
     addAndMakeVisible (graphPanel = new GraphEditorPanel (*graph));
 
     deviceManager.addChangeListener (graphPanel);
 
-    graphPlayer.setProcessor (&graph->getGraph());
+    graphRenderer = new ParallelGraphRenderer (*graph);
+    setParallelProcessing (MainHostWindow::isParallelProcessing());
+    graphPlayer.setProcessor (graphRenderer);
+    graphPanel->setLoadProfiler (&graphRenderer->getProfiler());
+    graphPanel->setShowsLoadOverlay (MainHostWindow::isShowingLoadOverlay());
 
     keyState.addListener (&graphPlayer.getMidiMessageCollector());
 
@@ -1096,6 +1172,7 @@ void GraphDocumentComponent::releaseGraph()
     deleteAllChildren();
 
     graphPlayer.setProcessor (nullptr);
+    graphRenderer = nullptr;
     graph = nullptr;
 }
 
@@ -1103,3 +1180,33 @@ void GraphDocumentComponent::setDoublePrecision (bool doublePrecision)
 {
     graphPlayer.setDoublePrecisionProcessing (doublePrecision);
 }
+
+void GraphDocumentComponent::setParallelProcessing (bool parallelProcessing)
+{
+    // one thread per core, the audio thread included; with just the audio thread the
+    // nodes still run through the renderer's schedule, so they stay profiled
+    graphRenderer->setNumThreads (parallelProcessing ? SystemStats::getNumCpus() : 1);
+}
+
+void GraphDocumentComponent::setShowsLoadOverlay (bool showLoad)
+{
+    graphPanel->setShowsLoadOverlay (showLoad);
+}
+
+bool GraphDocumentComponent::exportLoadFigures (const File& csvFile)
+{
+    const String csv (graphRenderer->getProfiler().createCsv ([this] (uint32 nodeId)
+    {
+        if (auto node = graph->getNodeForId (nodeId))
+            return node->getProcessor()->getName();
+
+        return String ("(removed)");
+    }));
+
+    return csvFile.replaceWithText (csv);
+}
+
+void GraphDocumentComponent::resetLoadFigures()
+{
+    graphRenderer->getProfiler().resetAll();
+}
@@ -27,6 +27,7 @@
 #pragma once
 
 #include "FilterGraph.h"
+#include "ParallelGraphRenderer.h"
 
 struct FilterComponent;
 struct ConnectorComponent;
@@ -38,7 +39,8 @@ struct PinComponent;
     A panel that displays and edits a FilterGraph.
 */
 class GraphEditorPanel   : public Component,
-                           public ChangeListener
+                           public ChangeListener,
+                           private Timer
 {
 public:
     GraphEditorPanel (FilterGraph& graph);
@@ -57,6 +59,15 @@ public:
     void changeListenerCallback (ChangeBroadcaster*);
     void updateComponents();
 
+    //==============================================================================
+    /** Shows each filter's DSP load on it, from the given profiler. */
+    void setLoadProfiler (NodeLoadProfiler*);
+    void setShowsLoadOverlay (bool shouldShow);
+    bool showsLoadOverlay() const noexcept          { return loadOverlayShown; }
+
+    /** nullptr unless the overlay is shown and the filter has been rendered. */
+    NodeLoadStats::Ptr getLoadStatsFor (uint32 filterID) const;
+
     //==============================================================================
     void beginConnectorDrag (uint32 sourceFilterID, int sourceFilterChannel,
                              uint32 destFilterID, int destFilterChannel,
@@ -68,6 +79,10 @@ public:
 private:
     FilterGraph& graph;
     ScopedPointer<ConnectorComponent> draggingConnector;
+    NodeLoadProfiler* loadProfiler = nullptr;
+    bool loadOverlayShown = false;
+
+    void timerCallback() override;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GraphEditorPanel)
 };
@@ -90,6 +105,12 @@ public:
     //==============================================================================
     void createNewPlugin (const PluginDescription&, Point<int> position);
     void setDoublePrecision (bool doublePrecision);
+    void setParallelProcessing (bool parallelProcessing);
+    void setShowsLoadOverlay (bool showLoad);
+
+    /** Writes every filter's DSP load figures as CSV. */
+    bool exportLoadFigures (const File& csvFile);
+    void resetLoadFigures();
 
     //==============================================================================
     ScopedPointer<FilterGraph> graph;
@@ -107,6 +128,7 @@ private:
     //==============================================================================
     AudioDeviceManager& deviceManager;
     AudioProcessorPlayer graphPlayer;
+    ScopedPointer<ParallelGraphRenderer> graphRenderer;
     MidiKeyboardState keyState;
 
 public:
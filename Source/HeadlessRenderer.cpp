@@ -0,0 +1,272 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "HeadlessRenderer.h"
+#include "InternalFilters.h"
+#include "ParallelGraphRenderer.h"
+
+
+//==============================================================================
+HeadlessRenderer::HeadlessRenderer (const StringArray& commandLineArguments)
+    : arguments (commandLineArguments)
+{
+    pluginFormats.addDefaultFormats();
+    pluginFormats.addFormat (new InternalPluginFormat());
+
+    audioFormats.registerBasicFormats();
+
+    // the graph adds its default I/O nodes asynchronously, so it has to exist before
+    // run() is called from a later message for loading the document to replace them
+    graph = new FilterGraph (pluginFormats);
+    graph->setRestoresPluginWindows (false);
+    graph->setWaitsForPluginsToLoad (true);
+}
+
+HeadlessRenderer::~HeadlessRenderer()
+{
+    graph = nullptr;
+}
+
+bool HeadlessRenderer::isRenderCommandLine (const StringArray& commandLineArguments)
+{
+    return commandLineArguments.contains ("--render");
+}
+
+String HeadlessRenderer::getOption (const String& name) const
+{
+    const int index = arguments.indexOf (name);
+    return index >= 0 ? arguments[index + 1] : String();
+}
+
+File HeadlessRenderer::getFileOption (const String& name) const
+{
+    const String path (getOption (name).unquoted());
+    return path.isNotEmpty() ? File::getCurrentWorkingDirectory().getChildFile (path) : File();
+}
+
+//==============================================================================
+static int fail (const String& message)
+{
+    std::cerr << message << std::endl;
+    return 1;
+}
+
+int HeadlessRenderer::run()
+{
+    const File graphFile (getFileOption ("--render"));
+    const File outputFile (getFileOption ("--output"));
+    const File inputFile (getFileOption ("--input"));
+    const File midiFile (getFileOption ("--midi"));
+    const File loadFile (getFileOption ("--load-csv"));
+
+    if (graphFile == File() || outputFile == File())
+        return fail ("Usage: --render <graph.filtergraph> --output <file.wav> [--input <file.wav>] [--midi <file.mid>]\n"
+                     "       [--length <seconds>] [--tail <seconds>] [--sample-rate <hz>] [--block-size <samples>]\n"
+                     "       [--channels <n>] [--bits <n>] [--threads <n>] [--load-csv <file.csv>]");
+
+    const Result loaded (graph->loadDocument (graphFile));
+
+    if (loaded.failed())
+        return fail ("Couldn't load " + graphFile.getFullPathName() + ": " + loaded.getErrorMessage());
+
+    std::cout << graph->getLastLoadReport();
+
+    //==============================================================================
+    ScopedPointer<AudioFormatReader> reader;
+
+    if (inputFile != File())
+    {
+        reader = audioFormats.createReaderFor (inputFile);
+
+        if (reader == nullptr)
+            return fail ("Couldn't read " + inputFile.getFullPathName());
+    }
+
+    MidiMessageSequence midiSequence;
+
+    if (midiFile != File())
+    {
+        FileInputStream stream (midiFile);
+        MidiFile midi;
+
+        if (! stream.openedOk() || ! midi.readFrom (stream))
+            return fail ("Couldn't read " + midiFile.getFullPathName());
+
+        midi.convertTimestampTicksToSeconds();
+
+        for (int i = 0; i < midi.getNumTracks(); ++i)
+            midiSequence.addSequence (*midi.getTrack (i), 0.0, 0.0, std::numeric_limits<double>::max());
+
+        midiSequence.sort();
+    }
+
+    const double sampleRate = getOption ("--sample-rate").getDoubleValue() > 0 ? getOption ("--sample-rate").getDoubleValue()
+                                                                             : (reader != nullptr ? reader->sampleRate : 44100.0);
+    const int blockSize = jlimit (1, 65536, getOption ("--block-size").isNotEmpty() ? getOption ("--block-size").getIntValue() : 512);
+    const int numOutputChannels = jmax (1, getOption ("--channels").isNotEmpty() ? getOption ("--channels").getIntValue() : 2);
+    const int numInputChannels = reader != nullptr ? (int) reader->numChannels : numOutputChannels;
+    const int bitsPerSample = getOption ("--bits").isNotEmpty() ? getOption ("--bits").getIntValue() : 24;
+    const int numThreads = jmax (1, getOption ("--threads").getIntValue());
+
+    double lengthSeconds = getOption ("--length").getDoubleValue();
+
+    if (lengthSeconds <= 0)
+        lengthSeconds = reader != nullptr ? reader->lengthInSamples / reader->sampleRate
+                                          : midiSequence.getEndTime();
+
+    const int64 numSamplesToRender = (int64) ((lengthSeconds + jmax (0.0, getOption ("--tail").getDoubleValue())) * sampleRate);
+
+    if (numSamplesToRender <= 0)
+        return fail ("Nothing to render: give an --input file, a --midi file or a --length");
+
+    //==============================================================================
+    AudioFormat* format = audioFormats.findFormatForFileExtension (outputFile.getFileExtension());
+
+    if (format == nullptr)
+        format = audioFormats.getDefaultFormat();
+
+    outputFile.deleteFile();
+    ScopedPointer<FileOutputStream> outputStream (outputFile.createOutputStream());
+
+    if (outputStream == nullptr)
+        return fail ("Couldn't write to " + outputFile.getFullPathName());
+
+    ScopedPointer<AudioFormatWriter> writer (format->createWriterFor (outputStream, sampleRate, (unsigned int) numOutputChannels,
+                                                                     bitsPerSample, StringPairArray(), 0));
+
+    if (writer == nullptr)
+        return fail ("Can't write " + String (numOutputChannels) + " channels of " + String (bitsPerSample)
+                       + " bit audio at " + String (sampleRate) + " Hz as " + format->getFormatName());
+
+    // the writer owns the stream now
+    outputStream.release();
+
+    //==============================================================================
+    ParallelGraphRenderer renderer (*graph);
+    renderer.setPlayConfigDetails (numInputChannels, numOutputChannels, sampleRate, blockSize);
+    renderer.setNonRealtime (true);
+    graph->getGraph().setNonRealtime (true);
+    renderer.setNumThreads (numThreads);
+    renderer.prepareToPlay (sampleRate, blockSize);
+
+    // the input is read through a resampler if it isn't at the rendering rate; past
+    // its end the reader source gives silence
+    ScopedPointer<AudioFormatReaderSource> readerSource;
+    ScopedPointer<ResamplingAudioSource> resampler;
+    AudioSource* input = nullptr;
+
+    if (reader != nullptr)
+    {
+        readerSource = new AudioFormatReaderSource (reader, false);
+        input = readerSource;
+
+        if (reader->sampleRate != sampleRate)
+        {
+            resampler = new ResamplingAudioSource (readerSource, false, numInputChannels);
+            resampler->setResamplingRatio (reader->sampleRate / sampleRate);
+            input = resampler;
+        }
+
+        input->prepareToPlay (blockSize, sampleRate);
+    }
+
+    AudioBuffer<float> buffer (jmax (numInputChannels, numOutputChannels), blockSize);
+    MidiBuffer midiMessages;
+    int nextMidiEvent = 0;
+    int lastPercentShown = -1;
+
+    const double startTime = Time::getMillisecondCounterHiRes();
+
+    for (int64 position = 0; position < numSamplesToRender; position += blockSize)
+    {
+        const int numSamples = (int) jmin ((int64) blockSize, numSamplesToRender - position);
+
+        // refers to the start of the buffer, cut to this block's length
+        AudioBuffer<float> block (buffer.getArrayOfWritePointers(), buffer.getNumChannels(), numSamples);
+        block.clear();
+
+        if (input != nullptr)
+        {
+            // only the input's channels are filled; the rest stay silent
+            AudioBuffer<float> inputBlock (block.getArrayOfWritePointers(), numInputChannels, numSamples);
+            input->getNextAudioBlock (AudioSourceChannelInfo (inputBlock));
+        }
+
+        midiMessages.clear();
+
+        for (; nextMidiEvent < midiSequence.getNumEvents(); ++nextMidiEvent)
+        {
+            const MidiMessage& message = midiSequence.getEventPointer (nextMidiEvent)->message;
+            const int64 samplePosition = (int64) (message.getTimeStamp() * sampleRate);
+
+            if (samplePosition >= position + numSamples)
+                break;
+
+            if (! message.isMetaEvent())
+                midiMessages.addEvent (message, (int) jmax ((int64) 0, samplePosition - position));
+        }
+
+        renderer.processBlock (block, midiMessages);
+        writer->writeFromAudioSampleBuffer (block, 0, numSamples);
+
+        const int percent = (int) ((position + numSamples) * 100 / numSamplesToRender);
+
+        if (percent / 10 != lastPercentShown / 10)
+        {
+            lastPercentShown = percent;
+            std::cout << "Rendered " << percent << "%" << std::endl;
+        }
+    }
+
+    const double secondsTaken = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    const double secondsRendered = numSamplesToRender / sampleRate;
+
+    renderer.releaseResources();
+    writer = nullptr;
+
+    if (input != nullptr)
+        input->releaseResources();
+
+    std::cout << "Rendered " << secondsRendered << " s to " << outputFile.getFullPathName()
+              << " in " << secondsTaken << " s (" << (secondsTaken > 0 ? secondsRendered / secondsTaken : 0.0)
+              << "x realtime)" << std::endl;
+
+    if (numThreads > 1)
+        std::cout << "Parallel speedup on " << numThreads << " threads: " << renderer.getParallelSpeedup() << "x" << std::endl;
+
+    if (loadFile != File())
+    {
+        const String csv (renderer.getProfiler().createCsv ([this] (uint32 nodeId)
+        {
+            if (auto node = graph->getNodeForId (nodeId))
+                return node->getProcessor()->getName();
+
+            return String ("(removed)");
+        }));
+
+        if (! loadFile.replaceWithText (csv))
+            return fail ("Couldn't write to " + loadFile.getFullPathName());
+    }
+
+    return 0;
+}
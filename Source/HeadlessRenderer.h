@@ -0,0 +1,67 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "FilterGraph.h"
+
+
+//==============================================================================
+/**
+    Renders a .filtergraph document offline, without opening any windows.
+
+    The graph is streamed an input audio file, a MIDI file, or just silence, as
+    fast as it will go, and what comes out of its audio output is written to a
+    file. Used for batch-rendering stems and for timing graphs on machines with
+    no display or audio device:
+
+        --render <graph.filtergraph> --output <file.wav> [--input <file.wav>]
+        [--midi <file.mid>] [--length <seconds>] [--tail <seconds>]
+        [--sample-rate <hz>] [--block-size <samples>] [--channels <n>]
+        [--bits <n>] [--threads <n>] [--load-csv <file.csv>]
+
+    The render lasts as long as --length, or else as long as the input file or
+    the MIDI file, and --tail adds silence after it so that reverbs can ring out.
+    An input file at a different rate from --sample-rate is resampled.
+*/
+class HeadlessRenderer
+{
+public:
+    HeadlessRenderer (const StringArray& commandLineArguments);
+    ~HeadlessRenderer();
+
+    static bool isRenderCommandLine (const StringArray& commandLineArguments);
+
+    /** Does the whole render on the message thread and returns the process's exit code. */
+    int run();
+
+private:
+    //==============================================================================
+    StringArray arguments;
+    AudioPluginFormatManager pluginFormats;
+    AudioFormatManager audioFormats;
+    ScopedPointer<FilterGraph> graph;
+
+    String getOption (const String& name) const;
+    File getFileOption (const String& name) const;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HeadlessRenderer)
+};
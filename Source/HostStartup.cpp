@@ -27,6 +27,9 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "MainHostWindow.h"
 #include "InternalFilters.h"
+#include "HeadlessRenderer.h"
+#include "OutOfProcessPluginScanner.h"
+#include "RealtimeSanitizerHooks.h"
 
 //#if ! (JUCE_PLUGINHOST_VST || JUCE_PLUGINHOST_VST3 || JUCE_PLUGINHOST_AU)
 // #error "If you're building the audio plugin host, you probably want to enable VST and/or AU support"
@@ -40,8 +43,17 @@ class PluginHostApp  : public JUCEApplication,
 public:
     PluginHostApp() {}
 
-    void initialise (const String&) override
+    void initialise (const String& commandLine) override
     {
+        // a plugin scanner started by the host's plugin list opens no windows, and
+        // quits when the host lets it go
+        scannerWorker = new PluginScannerWorker();
+
+        if (scannerWorker->initialiseFromCommandLine (commandLine, PluginScannerWorker::commandLineUID))
+            return;
+
+        scannerWorker = nullptr;
+
         // initialise our settings file..
 
         PropertiesFile::Options options;
@@ -52,6 +64,14 @@ public:
         appProperties = new ApplicationProperties();
         appProperties->setStorageParameters (options);
 
+        // a command-line render opens no windows, and quits once the file is written
+        if (HeadlessRenderer::isRenderCommandLine (getCommandLineParameterArray()))
+        {
+            headlessRenderer = new HeadlessRenderer (getCommandLineParameterArray());
+            triggerAsyncUpdate();
+            return;
+        }
+
         mainWindow = new MainHostWindow();
         mainWindow->setUsingNativeTitleBar (true);
 
@@ -73,6 +93,13 @@ public:
 
     void handleAsyncUpdate() override
     {
+        if (headlessRenderer != nullptr)
+        {
+            setApplicationReturnValue (headlessRenderer->run());
+            quit();
+            return;
+        }
+
         File fileToOpen;
 
         for (int i = 0; i < getCommandLineParameterArray().size(); ++i)
@@ -100,7 +127,9 @@ public:
 
     void shutdown() override
     {
+        scannerWorker = nullptr;
         mainWindow = nullptr;
+        headlessRenderer = nullptr;
         appProperties = nullptr;
         LookAndFeel::setDefaultLookAndFeel (nullptr);
     }
@@ -122,6 +151,8 @@ public:
 
 private:
     ScopedPointer<MainHostWindow> mainWindow;
+    ScopedPointer<HeadlessRenderer> headlessRenderer;
+    ScopedPointer<PluginScannerWorker> scannerWorker;
 };
 
 static PluginHostApp& getApp()                      { return *dynamic_cast<PluginHostApp*>(JUCEApplication::getInstance()); }
@@ -0,0 +1,169 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Blends an outgoing plugin instance into an incoming one with an equal-power
+    crossfade, both instances running on the same input.
+
+    The curve is read from a quarter-sine table made when the crossfader is
+    created, into gain buffers allocated in prepare(), so the length can change
+    without allocating and the audio thread only looks up, multiplies and adds.
+*/
+class InstanceCrossfader
+{
+public:
+    InstanceCrossfader()
+    {
+        quarterSine.malloc ((size_t) curveResolution + 1);
+
+        for (int i = 0; i <= curveResolution; ++i)
+            quarterSine[i] = std::sin (double_Pi * 0.5 * i / curveResolution);
+    }
+
+    /** Allocates room for blocks of up to maxBlockSize samples. */
+    void prepare (int numChannels, int maxBlockSize)
+    {
+        outgoingFloat.setSize (numChannels, maxBlockSize);
+        outgoingDouble.setSize (numChannels, maxBlockSize);
+        outgoingMidi.ensureSize (2048);
+
+        fadeInFloat.malloc ((size_t) maxBlockSize);
+        fadeOutFloat.malloc ((size_t) maxBlockSize);
+        fadeInDouble.malloc ((size_t) maxBlockSize);
+        fadeOutDouble.malloc ((size_t) maxBlockSize);
+    }
+
+    /** Sets the crossfade length. Doesn't allocate, but don't call this while a
+        crossfade is running.
+    */
+    void setLengthSamples (int newLength) noexcept
+    {
+        length = jmax (1, newLength);
+        position = length;
+    }
+
+    int getLengthSamples() const noexcept       { return length; }
+
+    //==============================================================================
+    /** Audio thread: starts a new crossfade from the next process() call. */
+    void start() noexcept                       { position = 0; }
+
+    bool isFinished() const noexcept            { return position >= length; }
+
+    /** Audio thread: runs the outgoing instance on a copy of the buffer's input,
+        then calls processIncoming() to fill the buffer itself, and mixes the two.
+
+        If the block is bigger than prepare() allowed for, the crossfade is cut
+        short rather than allocating.
+    */
+    template <typename FloatType, typename ProcessIncoming>
+    void process (AudioPluginInstance& outgoing, AudioBuffer<FloatType>& buffer, const MidiBuffer& midiMessages,
+                  ProcessIncoming&& processIncoming)
+    {
+        const int numSamples = buffer.getNumSamples();
+        AudioBuffer<FloatType>& scratch = getScratch ((FloatType*) nullptr);
+
+        if (numSamples > scratch.getNumSamples() || buffer.getNumChannels() > scratch.getNumChannels())
+        {
+            processIncoming();
+            position = length;
+            return;
+        }
+
+        const int numChannels = buffer.getNumChannels();
+
+        // a view onto the scratch space that's exactly the size of this block
+        AudioBuffer<FloatType> outgoingBuffer (scratch.getArrayOfWritePointers(), numChannels, numSamples);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            outgoingBuffer.copyFrom (channel, 0, buffer, channel, 0, numSamples);
+
+        outgoingMidi.clear();
+        outgoingMidi.addEvents (midiMessages, 0, numSamples, 0);
+
+        // the outgoing instance's midi output is dropped
+        outgoing.processBlock (outgoingBuffer, outgoingMidi);
+
+        processIncoming();
+
+        const int numFading = jmin (numSamples, length - position);
+
+        if (numFading > 0)
+        {
+            FloatType* fadeIn  = getCurve ((FloatType*) nullptr, true);
+            FloatType* fadeOut = getCurve ((FloatType*) nullptr, false);
+
+            for (int i = 0; i < numFading; ++i)
+            {
+                const double x = (position + i) * (double) curveResolution / length;
+
+                fadeIn[i]  = (FloatType) lookUpCurve (x);
+                fadeOut[i] = (FloatType) lookUpCurve (curveResolution - x);
+            }
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                FloatType* dest = buffer.getWritePointer (channel);
+
+                FloatVectorOperations::multiply (dest, fadeIn, numFading);
+                FloatVectorOperations::addWithMultiply (dest, outgoingBuffer.getReadPointer (channel), fadeOut, numFading);
+            }
+
+            position += numFading;
+        }
+    }
+
+private:
+    enum { curveResolution = 1024 };
+
+    int length = 1, position = 1;
+
+    AudioBuffer<float> outgoingFloat;
+    AudioBuffer<double> outgoingDouble;
+    MidiBuffer outgoingMidi;
+
+    HeapBlock<double> quarterSine;
+    HeapBlock<float> fadeInFloat, fadeOutFloat;
+    HeapBlock<double> fadeInDouble, fadeOutDouble;
+
+    // x runs from 0 to curveResolution
+    double lookUpCurve (double x) const noexcept
+    {
+        const int index = jlimit (0, curveResolution - 1, (int) x);
+        const double frac = jlimit (0.0, 1.0, x - index);
+
+        return quarterSine[index] + frac * (quarterSine[index + 1] - quarterSine[index]);
+    }
+
+    AudioBuffer<float>& getScratch (float*) noexcept        { return outgoingFloat; }
+    AudioBuffer<double>& getScratch (double*) noexcept      { return outgoingDouble; }
+
+    float* getCurve (float*, bool fadingIn) noexcept        { return fadingIn ? fadeInFloat : fadeOutFloat; }
+    double* getCurve (double*, bool fadingIn) noexcept      { return fadingIn ? fadeInDouble : fadeOutDouble; }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (InstanceCrossfader)
+};
@@ -74,3 +74,63 @@ void InternalPluginFormat::getAllTypes (OwnedArray<PluginDescription>& results)
     results.add (new PluginDescription (audioOutDesc));
     results.add (new PluginDescription (midiInDesc));
 }
+
+//==============================================================================
+PlaceholderProcessor::PlaceholderProcessor (const PluginDescription& desc)
+    : AudioPluginInstance (getBusesProperties (desc)),
+      description (desc)
+{
+}
+
+AudioProcessor::BusesProperties PlaceholderProcessor::getBusesProperties (const PluginDescription& desc)
+{
+    BusesProperties properties;
+
+    if (desc.numInputChannels > 0)
+        properties = properties.withInput ("Input", AudioChannelSet::canonicalChannelSet (desc.numInputChannels), true);
+
+    if (desc.numOutputChannels > 0)
+        properties = properties.withOutput ("Output", AudioChannelSet::canonicalChannelSet (desc.numOutputChannels), true);
+
+    return properties;
+}
+
+void PlaceholderProcessor::getStateInformation (MemoryBlock& destData)
+{
+    readStateFromSource();
+    destData = state;
+}
+
+void PlaceholderProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    stateSource = nullptr;
+    stateElement = nullptr;
+
+    state.setSize ((size_t) sizeInBytes);
+    state.copyFrom (data, 0, (size_t) sizeInBytes);
+}
+
+void PlaceholderProcessor::setStateSource (StateSource* source, const XmlElement& element)
+{
+    stateSource = source;
+    stateElement = &element;
+    state.reset();
+}
+
+void PlaceholderProcessor::setFailedToLoad()
+{
+    failedToLoad = true;
+    readStateFromSource();
+}
+
+void PlaceholderProcessor::readStateFromSource()
+{
+    if (stateSource == nullptr)
+        return;
+
+    if (! stateSource->readState (*stateElement, state))
+        state.reset();
+
+    stateSource = nullptr;
+    stateElement = nullptr;
+}
@@ -63,3 +63,81 @@ private:
 
     bool requiresUnblockedMessageThreadDuringCreation (const PluginDescription&) const noexcept override;
 };
+
+//==============================================================================
+/**
+    Stands in for a plugin while a graph is loaded lazily. It's silent, but it
+    has the plugin's description, buses and state, so the graph can be wired up,
+    played and saved before the plugin has loaded, or if it never does.
+*/
+class PlaceholderProcessor   : public AudioPluginInstance
+{
+public:
+    PlaceholderProcessor (const PluginDescription&);
+
+    /** Where a placeholder's state is read from, such as the document being loaded.
+        It's kept alive by the placeholders that still refer to it.
+    */
+    struct StateSource  : public ReferenceCountedObject
+    {
+        typedef ReferenceCountedObjectPtr<StateSource> Ptr;
+
+        /** Fills dest with the state the element refers to. */
+        virtual bool readState (const XmlElement& stateElement, MemoryBlock& dest) const = 0;
+    };
+
+    //==============================================================================
+    const String getName() const override                               { return description.name + (failedToLoad ? " (missing)" : " (loading)"); }
+    void fillInPluginDescription (PluginDescription& d) const override  { d = description; }
+
+    void prepareToPlay (double, int) override                           {}
+    void releaseResources() override                                    {}
+    void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midi) override    { buffer.clear(); midi.clear(); }
+
+    double getTailLengthSeconds() const override                        { return 0.0; }
+    bool acceptsMidi() const override                                   { return true; }
+    bool producesMidi() const override                                  { return true; }
+
+    bool hasEditor() const override                                     { return false; }
+    AudioProcessorEditor* createEditor() override                       { return nullptr; }
+
+    int getNumPrograms() override                                       { return 1; }
+    int getCurrentProgram() override                                    { return 0; }
+    void setCurrentProgram (int) override                               {}
+    const String getProgramName (int) override                          { return {}; }
+    void changeProgramName (int, const String&) override                {}
+
+    /** The state is kept as it is, to be given to the plugin or saved again. */
+    void getStateInformation (MemoryBlock& destData) override;
+    void setStateInformation (const void* data, int sizeInBytes) override;
+
+    /** Refers to the state rather than copying it: it's only read if it's asked
+        for, which it won't be if the plugin replaces this first. The element
+        belongs to the source.
+    */
+    void setStateSource (StateSource* source, const XmlElement& stateElement);
+
+    /** The plugin couldn't be created, so this is staying, to keep its state.
+        The state is read now, so the source can be let go of.
+    */
+    void setFailedToLoad();
+
+    // whatever layout the plugin was saved with
+    bool isBusesLayoutSupported (const BusesLayout&) const override     { return true; }
+    bool canAddBus (bool) const override                                { return true; }
+    bool canRemoveBus (bool) const override                             { return true; }
+
+private:
+    //==============================================================================
+    PluginDescription description;
+    MemoryBlock state;
+    StateSource::Ptr stateSource;
+    const XmlElement* stateElement = nullptr;
+    bool failedToLoad = false;
+
+    void readStateFromSource();
+
+    static BusesProperties getBusesProperties (const PluginDescription&);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PlaceholderProcessor)
+};
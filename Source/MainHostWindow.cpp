@@ -27,6 +27,7 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "MainHostWindow.h"
 #include "InternalFilters.h"
+#include "OutOfProcessPluginScanner.h"
 
 
 //==============================================================================
@@ -39,7 +40,12 @@ public:
     {
         const File deadMansPedalFile (getAppProperties().getUserSettings()->getFile().getSiblingFile ("RecentlyCrashedPluginsList"));
 
-        setContentOwned (new PluginListComponent (pluginFormatManager, owner.knownPluginList, deadMansPedalFile, getAppProperties().getUserSettings(), true), true);
+        auto* listComponent = new PluginListComponent (pluginFormatManager, owner.knownPluginList, deadMansPedalFile, getAppProperties().getUserSettings(), true);
+
+        // the scanning happens in child processes, so it can use all the cores
+        listComponent->setNumberOfThreadsForScanning (OutOfProcessPluginScanner::getNumScanningThreads());
+
+        setContentOwned (listComponent, true);
 
         setResizable (true, false);
         setResizeLimits (300, 400, 800, 1500);
@@ -96,6 +102,9 @@ MainHostWindow::MainHostWindow()
     if (savedPluginList != nullptr)
         knownPluginList.recreateFromXml (*savedPluginList);
 
+    // a plugin that crashes while being scanned only takes its scanner process down
+    knownPluginList.setCustomScanner (new OutOfProcessPluginScanner());
+
     pluginSortMethod = (KnownPluginList::SortMethod) getAppProperties().getUserSettings()->getIntValue ("pluginSortMethod", KnownPluginList::sortByManufacturer);
 
     knownPluginList.addChangeListener (this);
@@ -253,6 +262,14 @@ PopupMenu MainHostWindow::getMenuForIndex (int topLevelMenuIndex, const String&
         menu.addSeparator();
         menu.addCommandItem (&getCommandManager(), CommandIDs::showAudioSettings);
         menu.addCommandItem (&getCommandManager(), CommandIDs::toggleDoublePrecision);
+        menu.addCommandItem (&getCommandManager(), CommandIDs::toggleParallelProcessing);
+        menu.addCommandItem (&getCommandManager(), CommandIDs::toggleLazyLoading);
+        menu.addCommandItem (&getCommandManager(), CommandIDs::toggleBinaryGraphFiles);
+
+        menu.addSeparator();
+        menu.addCommandItem (&getCommandManager(), CommandIDs::toggleLoadOverlay);
+        menu.addCommandItem (&getCommandManager(), CommandIDs::exportLoadFigures);
+        menu.addCommandItem (&getCommandManager(), CommandIDs::resetLoadFigures);
 
         menu.addSeparator();
         menu.addCommandItem (&getCommandManager(), CommandIDs::aboutBox);
@@ -353,6 +370,12 @@ void MainHostWindow::getAllCommands (Array<CommandID>& commands)
                               CommandIDs::showPluginListEditor,
                               CommandIDs::showAudioSettings,
                               CommandIDs::toggleDoublePrecision,
+                              CommandIDs::toggleParallelProcessing,
+                              CommandIDs::toggleLazyLoading,
+                              CommandIDs::toggleBinaryGraphFiles,
+                              CommandIDs::toggleLoadOverlay,
+                              CommandIDs::exportLoadFigures,
+                              CommandIDs::resetLoadFigures,
                               CommandIDs::aboutBox,
                               CommandIDs::allWindowsForward
                             };
@@ -402,6 +425,30 @@ void MainHostWindow::getCommandInfo (const CommandID commandID, ApplicationComma
         updatePrecisionMenuItem (result);
         break;
 
+    case CommandIDs::toggleParallelProcessing:
+        updateParallelMenuItem (result);
+        break;
+
+    case CommandIDs::toggleLazyLoading:
+        updateLazyLoadingMenuItem (result);
+        break;
+
+    case CommandIDs::toggleBinaryGraphFiles:
+        updateBinaryGraphFilesMenuItem (result);
+        break;
+
+    case CommandIDs::toggleLoadOverlay:
+        updateLoadOverlayMenuItem (result);
+        break;
+
+    case CommandIDs::exportLoadFigures:
+        result.setInfo ("Export DSP load as CSV...", "Saves each plugin's processing time figures to a file", category, 0);
+        break;
+
+    case CommandIDs::resetLoadFigures:
+        result.setInfo ("Reset DSP load figures", String(), category, 0);
+        break;
+
     case CommandIDs::aboutBox:
         result.setInfo ("About...", String(), category, 0);
         break;
@@ -470,6 +517,97 @@ bool MainHostWindow::perform (const InvocationInfo& info)
         }
         break;
 
+    case CommandIDs::toggleParallelProcessing:
+        if (auto* props = getAppProperties().getUserSettings())
+        {
+            bool newIsParallel = ! isParallelProcessing();
+            props->setValue ("parallelProcessing", var (newIsParallel));
+
+            {
+                ApplicationCommandInfo cmdInfo (info.commandID);
+                updateParallelMenuItem (cmdInfo);
+                menuItemsChanged();
+            }
+
+            if (graphEditor != nullptr)
+                graphEditor->setParallelProcessing (newIsParallel);
+        }
+        break;
+
+    case CommandIDs::toggleLazyLoading:
+        if (auto* props = getAppProperties().getUserSettings())
+        {
+            bool newIsLazy = ! isLoadingGraphsLazily();
+            props->setValue ("lazyGraphLoading", var (newIsLazy));
+
+            {
+                ApplicationCommandInfo cmdInfo (info.commandID);
+                updateLazyLoadingMenuItem (cmdInfo);
+                menuItemsChanged();
+            }
+
+            if (graphEditor != nullptr && graphEditor->graph != nullptr)
+                graphEditor->graph->setLoadsLazily (newIsLazy);
+        }
+        break;
+
+    case CommandIDs::toggleBinaryGraphFiles:
+        if (auto* props = getAppProperties().getUserSettings())
+        {
+            // the current document may have been opened in the other format
+            bool newIsBinary = (graphEditor != nullptr && graphEditor->graph != nullptr)
+                                  ? ! graphEditor->graph->savesBinaryDocument()
+                                  : ! isSavingGraphsAsBinary();
+
+            props->setValue ("binaryGraphFiles", var (newIsBinary));
+
+            if (graphEditor != nullptr && graphEditor->graph != nullptr)
+                graphEditor->graph->setSavesBinary (newIsBinary);
+
+            {
+                ApplicationCommandInfo cmdInfo (info.commandID);
+                updateBinaryGraphFilesMenuItem (cmdInfo);
+                menuItemsChanged();
+            }
+        }
+        break;
+
+    case CommandIDs::toggleLoadOverlay:
+        if (auto* props = getAppProperties().getUserSettings())
+        {
+            bool newIsShowingLoad = ! isShowingLoadOverlay();
+            props->setValue ("showLoadOverlay", var (newIsShowingLoad));
+
+            {
+                ApplicationCommandInfo cmdInfo (info.commandID);
+                updateLoadOverlayMenuItem (cmdInfo);
+                menuItemsChanged();
+            }
+
+            if (graphEditor != nullptr)
+                graphEditor->setShowsLoadOverlay (newIsShowingLoad);
+        }
+        break;
+
+    case CommandIDs::exportLoadFigures:
+        if (graphEditor != nullptr)
+        {
+            FileChooser fc ("Export DSP load figures...",
+                            File::getSpecialLocation (File::userDocumentsDirectory).getChildFile ("DSP load.csv"),
+                            "*.csv");
+
+            if (fc.browseForFileToSave (true) && ! graphEditor->exportLoadFigures (fc.getResult()))
+                AlertWindow::showMessageBoxAsync (AlertWindow::WarningIcon,
+                                                  "Couldn't export the DSP load figures",
+                                                  "Couldn't write to " + fc.getResult().getFullPathName());
+        }
+        break;
+
+    case CommandIDs::resetLoadFigures:
+        if (graphEditor != nullptr)
+            graphEditor->resetLoadFigures();
+        break;
+
     case CommandIDs::aboutBox:
         // TODO
         break;
@@ -577,3 +715,63 @@ void MainHostWindow::updatePrecisionMenuItem (ApplicationCommandInfo& info)
     info.setInfo ("Double floating point precision rendering", String(), "General", 0);
     info.setTicked (isDoublePrecisionProcessing());
 }
+
+bool MainHostWindow::isParallelProcessing()
+{
+    if (auto* props = getAppProperties().getUserSettings())
+        return props->getBoolValue ("parallelProcessing", false);
+
+    return false;
+}
+
+void MainHostWindow::updateParallelMenuItem (ApplicationCommandInfo& info)
+{
+    info.setInfo ("Render independent plugins in parallel", String(), "General", 0);
+    info.setTicked (isParallelProcessing());
+}
+
+bool MainHostWindow::isShowingLoadOverlay()
+{
+    if (auto* props = getAppProperties().getUserSettings())
+        return props->getBoolValue ("showLoadOverlay", false);
+
+    return false;
+}
+
+void MainHostWindow::updateLoadOverlayMenuItem (ApplicationCommandInfo& info)
+{
+    info.setInfo ("Show each plugin's DSP load", String(), "General", 0);
+    info.setTicked (isShowingLoadOverlay());
+}
+
+bool MainHostWindow::isLoadingGraphsLazily()
+{
+    if (auto* props = getAppProperties().getUserSettings())
+        return props->getBoolValue ("lazyGraphLoading", false);
+
+    return false;
+}
+
+void MainHostWindow::updateLazyLoadingMenuItem (ApplicationCommandInfo& info)
+{
+    info.setInfo ("Open graphs before their plugins have loaded", String(), "General", 0);
+    info.setTicked (isLoadingGraphsLazily());
+}
+
+bool MainHostWindow::isSavingGraphsAsBinary()
+{
+    if (auto* props = getAppProperties().getUserSettings())
+        return props->getBoolValue ("binaryGraphFiles", true);
+
+    return true;
+}
+
+// ticked for the format the current document will be saved in
+void MainHostWindow::updateBinaryGraphFilesMenuItem (ApplicationCommandInfo& info)
+{
+    auto* graphEditor = getGraphEditor();
+
+    info.setInfo ("Save graphs in the binary format", "Saves the plugin states as binary chunks rather than as XML text", "General", 0);
+    info.setTicked ((graphEditor != nullptr && graphEditor->graph != nullptr) ? graphEditor->graph->savesBinaryDocument()
+                                                                             : isSavingGraphsAsBinary());
+}
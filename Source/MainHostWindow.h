@@ -42,6 +42,12 @@ namespace CommandIDs
     static const int aboutBox               = 0x30300;
     static const int allWindowsForward      = 0x30400;
     static const int toggleDoublePrecision  = 0x30500;
+    static const int toggleParallelProcessing = 0x30600;
+    static const int toggleLoadOverlay      = 0x30700;
+    static const int exportLoadFigures      = 0x30800;
+    static const int resetLoadFigures       = 0x30900;
+    static const int toggleLazyLoading      = 0x30a00;
+    static const int toggleBinaryGraphFiles = 0x30b00;
 }
 
 ApplicationCommandManager& getCommandManager();
@@ -92,6 +98,14 @@ public:
 
     bool isDoublePrecisionProcessing();
     void updatePrecisionMenuItem (ApplicationCommandInfo& info);
+    static bool isParallelProcessing();
+    void updateParallelMenuItem (ApplicationCommandInfo& info);
+    static bool isShowingLoadOverlay();
+    void updateLoadOverlayMenuItem (ApplicationCommandInfo& info);
+    static bool isLoadingGraphsLazily();
+    void updateLazyLoadingMenuItem (ApplicationCommandInfo& info);
+    static bool isSavingGraphsAsBinary();
+    void updateBinaryGraphFilesMenuItem (ApplicationCommandInfo& info);
 
 private:
     //==============================================================================
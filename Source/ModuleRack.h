@@ -0,0 +1,640 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RealtimeFifo.h"
+#include "RealtimeObjectHandoff.h"
+#include "ParameterAddressIndex.h"
+#include "FxpPresetCache.h"
+#include "PluginStateContainer.h"
+#include "PluginStateCache.h"
+#include "PluginInstanceRequest.h"
+
+
+//==============================================================================
+/**
+    The extra copies of the wrapped plugin that answer to /module/1/ and up.
+    Module 0 is the processor's own wrapped instance and isn't kept here.
+
+    Every module is an instance of the same plugin as module 0, created on a
+    background thread and published through a RealtimeObjectHandoff. Each one
+    has its own address table and parameter queue, and its own buffer, so the
+    audio thread can render the modules on different threads at once and mix
+    them afterwards.
+
+    A preset is loaded into a module while it's faded out, as module 0 does,
+    but the fades are a block long and parameter changes are applied at the
+    start of the next block rather than at the sample they arrived on.
+*/
+class ModuleRack  : private Thread
+{
+public:
+    enum { maxModules = 8 };
+
+    struct Listener
+    {
+        virtual ~Listener() {}
+
+        /** Called on the rack's thread once a module has taken a preset. */
+        virtual void modulePresetLoaded (int moduleIndex, const String& presetName) = 0;
+    };
+
+    ModuleRack (AudioPluginFormatManager& formats, FxpPresetCache& presets,
+                const CriticalSection& audioCallbackLock, Listener& l)
+        : Thread ("Module rack"), formatManager (formats), presetCache (presets),
+          callbackLock (audioCallbackLock), listener (l)
+    {
+        for (int i = 1; i < maxModules; ++i)
+            modules.add (new Module());
+
+        startThread (3);
+    }
+
+    ~ModuleRack()
+    {
+        stopThread (10000);
+    }
+
+    //==============================================================================
+    /** The plugin the modules are instances of. Changing it creates them again. */
+    void setPluginDescription (const PluginDescription& newDescription)
+    {
+        {
+            const ScopedLock sl (lock);
+
+            if (hasDescription && description.createIdentifierString() == newDescription.createIdentifierString())
+                return;
+
+            description = newDescription;
+            hasDescription = true;
+
+            for (auto* m : modules)
+                m->clear();
+        }
+
+        notify();
+    }
+
+    void setAddressMappingRule (ParameterAddressIndex::MappingRule newRule)
+    {
+        const ScopedLock sl (lock);
+
+        if (addressMappingRule == newRule)
+            return;
+
+        addressMappingRule = newRule;
+
+        for (auto* m : modules)
+            updateDispatcher (*m);
+    }
+
+    /** The number of modules, counting module 0. Modules past the new count are
+        deleted, and new ones are created in the background.
+    */
+    void setNumModules (int newNumModules)
+    {
+        newNumModules = jlimit (1, (int) maxModules, newNumModules);
+
+        {
+            const ScopedLock sl (lock);
+
+            for (int i = newNumModules; i < maxModules; ++i)
+            {
+                Module& m = getModule (i);
+                m.clear();
+                m.presetName.clear();
+                m.stateToRestore.reset();
+            }
+
+            numModules = newNumModules;
+        }
+
+        notify();
+    }
+
+    int getNumModules() const noexcept          { return numModules.get(); }
+
+    /** Call while the audio thread is stopped, from the processor's prepareToPlay(). */
+    void setPlaybackConfiguration (double newSampleRate, int newBlockSize, int newNumChannels)
+    {
+        const ScopedLock sl (lock);
+
+        sampleRate = newSampleRate;
+        blockSize = newBlockSize;
+        numChannels = jmax (1, newNumChannels);
+
+        for (auto* m : modules)
+        {
+            m->floatBuffer.setSize (numChannels, blockSize);
+            m->doubleBuffer.setSize (numChannels, blockSize);
+            m->midi.ensureSize (2048);
+
+            const ScopedLock instanceLock (m->instance.getLock());
+
+            if (AudioPluginInstance* instance = m->instance.get())
+            {
+                instance->releaseResources();
+                instance->prepareToPlay (sampleRate, blockSize);
+            }
+        }
+    }
+
+    //==============================================================================
+    /** Called from the OSC thread: queues a change for the module's next block.
+        name is the address with the /module/N prefix stripped.
+    */
+    bool setParameter (int moduleIndex, const char* name, size_t numBytes, float value)
+    {
+        if (moduleIndex <= 0 || moduleIndex >= getNumModules())
+            return false;
+
+        Module& m = getModule (moduleIndex);
+        int parameterIndex = -1;
+
+        {
+            const ScopedLock sl (m.dispatcherLock);
+
+            if (m.dispatcher != nullptr)
+                parameterIndex = m.dispatcher->find (name, numBytes);
+        }
+
+        if (parameterIndex < 0)
+            return false;
+
+        Change change = { parameterIndex, value };
+        return m.parameterChanges.push (change);
+    }
+
+    /** Loads fileName.fxp into a module in the background. Returns immediately. */
+    void loadPreset (int moduleIndex, const String& presetName)
+    {
+        if (moduleIndex <= 0 || moduleIndex >= getNumModules())
+            return;
+
+        {
+            const ScopedLock sl (lock);
+            getModule (moduleIndex).presetToLoad = presetName;
+        }
+
+        notify();
+    }
+
+    //==============================================================================
+    /** The module states go into the container as chunks of their own. Each
+        module's state stays in its cache, so the container has to be written
+        before this is called again.
+    */
+    XmlElement* createXml (PluginStateContainer& container) const
+    {
+        XmlElement* xml = new XmlElement ("MODULES");
+
+        const ScopedLock sl (lock);
+        xml->setAttribute ("count", getNumModules());
+
+        for (int i = 1; i < getNumModules(); ++i)
+        {
+            Module& m = getModule (i);
+            XmlElement* e = xml->createNewChildElement ("MODULE");
+            e->setAttribute ("index", i);
+            e->setAttribute ("preset", m.presetName);
+
+            const ScopedLock instanceLock (m.instance.getLock());
+
+            if (AudioPluginInstance* instance = m.instance.get())
+            {
+                const MemoryBlock& state = m.stateCache.getState (*instance);
+
+                if (state.getSize() > 0)
+                    container.storeChunk (*e, state, m.stateCache.getSnapshotId());
+            }
+            else if (m.stateToRestore.getSize() > 0)
+            {
+                container.storeChunk (*e, MemoryBlock (m.stateToRestore));
+            }
+        }
+
+        return xml;
+    }
+
+    /** The modules are created again with the saved states, once the plugin is known. */
+    void restoreFromXml (const XmlElement& xml, const PluginStateContainer& container)
+    {
+        {
+            const ScopedLock sl (lock);
+
+            for (auto* m : modules)
+            {
+                m->clear();
+                m->presetName.clear();
+                m->stateToRestore.reset();
+            }
+
+            forEachXmlChildElementWithTagName (xml, e, "MODULE")
+            {
+                const int index = e->getIntAttribute ("index");
+
+                if (index > 0 && index < maxModules)
+                {
+                    Module& m = getModule (index);
+                    m.presetName = e->getStringAttribute ("preset");
+                    container.readChunk (*e, m.stateToRestore);
+                }
+            }
+        }
+
+        setNumModules (xml.getIntAttribute ("count", 1));
+    }
+
+    //==============================================================================
+    /** Audio thread: gives every module a copy of the block's input before anything
+        overwrites it. numSamples must be within the prepared block size.
+    */
+    template <typename FloatType>
+    void copyInput (const AudioBuffer<FloatType>& input, int numInputChannels, const MidiBuffer& midiMessages) noexcept
+    {
+        const int numSamples = input.getNumSamples();
+
+        for (int i = 1; i < getNumModules(); ++i)
+        {
+            Module& m = getModule (i);
+            AudioBuffer<FloatType>& buffer = m.getBuffer ((FloatType*) nullptr);
+
+            if (numSamples > buffer.getNumSamples())
+                continue;
+
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            {
+                if (channel < numInputChannels)
+                    buffer.copyFrom (channel, 0, input, channel, 0, numSamples);
+                else
+                    buffer.clear (channel, 0, numSamples);
+            }
+
+            m.midi.clear();
+            m.midi.addEvents (midiMessages, 0, numSamples, 0);
+        }
+    }
+
+    /** Audio thread, possibly a worker: renders one module into its own buffer.
+        Returns false if the module had nothing to play.
+    */
+    template <typename FloatType>
+    bool processModule (int moduleIndex, int numSamples, AudioPlayHead* playHead) noexcept
+    {
+        Module& m = getModule (moduleIndex);
+        AudioBuffer<FloatType>& scratch = m.getBuffer ((FloatType*) nullptr);
+        bool hasOutput = false;
+
+        if (numSamples <= scratch.getNumSamples())
+        {
+            // refers to the scratch space, so nothing is allocated
+            AudioBuffer<FloatType> buffer (scratch.getArrayOfWritePointers(), scratch.getNumChannels(), numSamples);
+            const int fadeState = m.fadeState.get();
+
+            if (fadeState != silent)
+            {
+                if (AudioPluginInstance* instance = m.instance.acquire())
+                {
+                    Change change;
+
+                    while (m.parameterChanges.pop (change))
+                    {
+                        instance->setParameter (change.parameterIndex, change.value);
+                        m.stateCache.markDirty();
+                    }
+
+                    // MIDI can change the state without the listeners hearing about it
+                    if (! m.midi.isEmpty())
+                        m.stateCache.markDirty();
+
+                    instance->setPlayHead (playHead);
+                    instance->processBlock (buffer, m.midi);
+                    hasOutput = true;
+
+                    if (fadeState == fadeOutRequested)
+                    {
+                        buffer.applyGainRamp (0, numSamples, 1, 0);
+                        m.fadeState.compareAndSetBool (silent, fadeOutRequested);
+                    }
+                    else if (fadeState == fadingIn)
+                    {
+                        buffer.applyGainRamp (0, numSamples, 0, 1);
+                        m.fadeState.compareAndSetBool (playing, fadingIn);
+                    }
+                }
+
+                m.instance.release();
+            }
+        }
+
+        m.hasOutput = hasOutput;
+        return hasOutput;
+    }
+
+    /** Audio thread: what processModule() rendered, or nullptr if there's nothing. */
+    template <typename FloatType>
+    const AudioBuffer<FloatType>* getOutput (int moduleIndex) noexcept
+    {
+        Module& m = getModule (moduleIndex);
+        return m.hasOutput ? &m.getBuffer ((FloatType*) nullptr) : nullptr;
+    }
+
+private:
+    //==============================================================================
+    struct Change
+    {
+        int parameterIndex;
+        float value;
+    };
+
+    enum FadeState
+    {
+        playing = 0,
+        fadeOutRequested,
+        silent,
+        fadingIn
+    };
+
+    struct Module
+    {
+        Module() : parameterChanges (1024) {}
+
+        // bumped whenever the module should be created again, so an instance
+        // made for the old configuration is thrown away
+        void clear()
+        {
+            // detached while the instance still exists
+            stateCache.attachTo (nullptr);
+            instance.set (nullptr);
+            ++generation;
+            contentHash = ParameterAddressIndex::unknownContents;
+
+            const ScopedLock sl (dispatcherLock);
+            dispatcher = nullptr;
+        }
+
+        AudioBuffer<float>& getBuffer (float*) noexcept     { return floatBuffer; }
+        AudioBuffer<double>& getBuffer (double*) noexcept   { return doubleBuffer; }
+
+        RealtimeObjectHandoff<AudioPluginInstance, PluginInstanceDeletePolicy> instance;
+        RealtimeFifo<Change> parameterChanges;
+
+        // declared after the instance, so it's deleted while the instance still exists
+        PluginStateCache stateCache;
+        Atomic<int> fadeState;
+
+        CriticalSection dispatcherLock;
+        OscAddressDispatcher::Ptr dispatcher;
+
+        // under the rack's lock
+        int generation = 0;
+        String presetName, presetToLoad;
+        MemoryBlock stateToRestore;
+        int64 contentHash = ParameterAddressIndex::unknownContents;    // what the address table is cached by
+
+        // audio thread only
+        AudioBuffer<float> floatBuffer;
+        AudioBuffer<double> doubleBuffer;
+        MidiBuffer midi;
+        bool hasOutput = false;
+    };
+
+    AudioPluginFormatManager& formatManager;
+    FxpPresetCache& presetCache;
+    const CriticalSection& callbackLock;
+    Listener& listener;
+
+    CriticalSection lock;
+    OwnedArray<Module> modules;
+    Atomic<int> numModules { 1 };
+    PluginDescription description;
+    bool hasDescription = false;
+    double sampleRate = 44100.0;
+    int blockSize = 512, numChannels = 2;
+
+    SharedResourcePointer<ParameterAddressIndex> addressIndex;
+    ParameterAddressIndex::MappingRule addressMappingRule = ParameterAddressIndex::slashPrefixed;
+
+    Module& getModule (int moduleIndex) const noexcept      { return *modules.getUnchecked (moduleIndex - 1); }
+
+    // call with the rack's lock held
+    void updateDispatcher (Module& m)
+    {
+        OscAddressDispatcher::Ptr newDispatcher;
+
+        {
+            const ScopedLock instanceLock (m.instance.getLock());
+
+            if (AudioPluginInstance* instance = m.instance.get())
+                newDispatcher = addressIndex->getDispatcherFor (*instance, addressMappingRule, m.contentHash);
+        }
+
+        const ScopedLock sl (m.dispatcherLock);
+        m.dispatcher = newDispatcher;
+    }
+
+    //==============================================================================
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            if (! createNextModule() && ! loadNextPreset())
+                wait (1000);
+        }
+    }
+
+    // returns false if every module already has an instance
+    bool createNextModule()
+    {
+        PluginDescription desc;
+        MemoryBlock state;
+        String presetName;
+        double rate;
+        int size, moduleIndex = -1, generation = 0;
+
+        {
+            const ScopedLock sl (lock);
+
+            if (! hasDescription)
+                return false;
+
+            for (int i = 1; i < getNumModules() && moduleIndex < 0; ++i)
+            {
+                Module& m = getModule (i);
+
+                if (m.instance.get() == nullptr)
+                {
+                    moduleIndex = i;
+                    generation = m.generation;
+                    state = m.stateToRestore;
+                    presetName = m.presetToLoad.isNotEmpty() ? m.presetToLoad : m.presetName;
+                }
+            }
+
+            if (moduleIndex < 0)
+                return false;
+
+            desc = description;
+            rate = sampleRate;
+            size = blockSize;
+        }
+
+        ScopedPointer<AudioPluginInstance> instance (PluginInstanceRequest::create (formatManager, desc, rate, size, *this));
+
+        if (instance == nullptr)
+        {
+            // don't spin on a plugin that won't load
+            wait (5000);
+            return true;
+        }
+
+        instance->enableAllBuses();
+        int64 contentHash = ParameterAddressIndex::unknownContents;
+
+        if (state.getSize() > 0)
+        {
+            instance->setStateInformation (state.getData(), (int) state.getSize());
+            contentHash = ParameterAddressIndex::hashChunk (state);
+        }
+        else if (presetName.isNotEmpty())
+        {
+            if (FxpPreset::Ptr preset = presetCache.getPreset (presetName))
+            {
+                loadPresetInto (*instance, *preset);
+                contentHash = ParameterAddressIndex::hashChunk (preset->data);
+            }
+        }
+
+        instance->prepareToPlay (rate, size);
+
+        const ScopedLock sl (lock);
+        Module& m = getModule (moduleIndex);
+
+        // thrown away if the module was cleared, or the block size changed, meanwhile
+        if (m.generation == generation && moduleIndex < getNumModules() && rate == sampleRate && size == blockSize)
+        {
+            m.fadeState = playing;
+            m.stateCache.attachTo (instance);
+            m.instance.set (instance.release());
+            m.stateToRestore.reset();
+            m.contentHash = contentHash;
+
+            if (state.getSize() == 0 && m.presetToLoad == presetName)
+            {
+                m.presetName = presetName;
+                m.presetToLoad.clear();
+            }
+
+            updateDispatcher (m);
+        }
+
+        return true;
+    }
+
+    // returns false if there was no preset waiting
+    bool loadNextPreset()
+    {
+        String presetName;
+        int moduleIndex = -1;
+
+        {
+            const ScopedLock sl (lock);
+
+            for (int i = 1; i < getNumModules() && moduleIndex < 0; ++i)
+            {
+                Module& m = getModule (i);
+
+                if (m.presetToLoad.isNotEmpty() && m.instance.get() != nullptr)
+                {
+                    moduleIndex = i;
+                    presetName = m.presetToLoad;
+                    m.presetToLoad.clear();
+                }
+            }
+        }
+
+        if (moduleIndex < 0)
+            return false;
+
+        FxpPreset::Ptr preset (presetCache.getPreset (presetName));
+
+        if (preset == nullptr)
+            return true;
+
+        const int64 contentHash = ParameterAddressIndex::hashChunk (preset->data);
+        Module& m = getModule (moduleIndex);
+
+        {
+            // keeps the instance from being replaced and deleted while the preset goes in
+            const ScopedLock instanceLock (m.instance.getLock());
+            AudioPluginInstance* instance = m.instance.get();
+
+            if (instance == nullptr)
+                return true;
+
+            m.fadeState = fadeOutRequested;
+
+            const double deadlineMs = Time::getMillisecondCounterHiRes() + 250.0;
+
+            while (m.fadeState.get() != silent && Time::getMillisecondCounterHiRes() < deadlineMs
+                    && ! threadShouldExit())
+                Thread::sleep (1);
+
+            if (m.fadeState.get() == silent)
+            {
+                loadPresetInto (*instance, *preset);
+            }
+            else
+            {
+                // the audio thread didn't answer, so it isn't running
+                const ScopedLock cl (callbackLock);
+                loadPresetInto (*instance, *preset);
+            }
+
+            m.stateCache.markDirty();
+
+            m.fadeState = fadingIn;
+        }
+
+        {
+            const ScopedLock sl (lock);
+            m.presetName = presetName;
+            m.contentHash = contentHash;
+            updateDispatcher (m);
+        }
+
+        listener.modulePresetLoaded (moduleIndex, presetName);
+        return true;
+    }
+
+    static void loadPresetInto (AudioPluginInstance& instance, const FxpPreset& preset)
+    {
+       #if JUCE_PLUGINHOST_VST
+        VSTPluginFormat::loadFromFXBFile (&instance, preset.data.getData(), preset.data.getSize());
+       #else
+        ignoreUnused (instance, preset);
+       #endif
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ModuleRack)
+};
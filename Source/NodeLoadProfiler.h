@@ -0,0 +1,232 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    How long one node (or the whole graph) has been taking to process a block,
+    compared with the time the block lasts.
+
+    addBlock() is called by whichever thread rendered the node, never by two at
+    once, and only stores to atomics, so the GUI can read the figures at any time.
+    Durations are also counted into a histogram of 10% steps of the block's
+    duration, so an occasional spike shows up even when the average looks fine.
+*/
+class NodeLoadStats  : public ReferenceCountedObject
+{
+public:
+    typedef ReferenceCountedObjectPtr<NodeLoadStats> Ptr;
+
+    // the last bin counts everything over 200%
+    enum { numBins = 21, percentPerBin = 10 };
+
+    struct Snapshot
+    {
+        int64 numBlocks, numOverruns;
+        double lastMs, averageMs, worstMs;
+        double lastPercent, averagePercent, worstPercent;
+        int64 histogram[numBins];
+    };
+
+    NodeLoadStats() {}
+
+    //==============================================================================
+    /** Audio thread: records one block. budgetTicks is how long the block lasts. */
+    void addBlock (int64 ticks, int64 budgetTicks) noexcept
+    {
+        if (resetRequested.exchange (0) != 0)
+            clear();
+
+        const double percent = budgetTicks > 0 ? ticks * 100.0 / budgetTicks : 0.0;
+
+        ++numBlocks;
+        totalTicks += ticks;
+        totalBudgetTicks += budgetTicks;
+        lastTicks = ticks;
+        lastBudgetTicks = budgetTicks;
+
+        if (ticks > worstTicks.get())
+        {
+            worstTicks = ticks;
+            worstBudgetTicks = budgetTicks;
+        }
+
+        if (percent > 100.0)
+            ++numOverruns;
+
+        ++histogram[jmin ((int) numBins - 1, (int) (percent / percentPerBin))];
+    }
+
+    /** Any thread: the figures are cleared before the next block is recorded. */
+    void reset() noexcept               { resetRequested = 1; }
+
+    Snapshot getSnapshot() const noexcept
+    {
+        Snapshot s;
+        s.numBlocks = numBlocks.get();
+        s.numOverruns = numOverruns.get();
+
+        s.lastMs    = ticksToMs (lastTicks.get());
+        s.worstMs   = ticksToMs (worstTicks.get());
+        s.averageMs = s.numBlocks > 0 ? ticksToMs (totalTicks.get()) / s.numBlocks : 0.0;
+
+        s.lastPercent    = toPercent (lastTicks.get(), lastBudgetTicks.get());
+        s.worstPercent   = toPercent (worstTicks.get(), worstBudgetTicks.get());
+        s.averagePercent = toPercent (totalTicks.get(), totalBudgetTicks.get());
+
+        for (int i = 0; i < numBins; ++i)
+            s.histogram[i] = histogram[i].get();
+
+        return s;
+    }
+
+private:
+    Atomic<int64> numBlocks, numOverruns, totalTicks, totalBudgetTicks;
+    Atomic<int64> lastTicks, lastBudgetTicks, worstTicks, worstBudgetTicks;
+    Atomic<int64> histogram[numBins];
+    Atomic<int> resetRequested;
+
+    void clear() noexcept
+    {
+        numBlocks = 0;
+        numOverruns = 0;
+        totalTicks = 0;
+        totalBudgetTicks = 0;
+        lastTicks = 0;
+        lastBudgetTicks = 0;
+        worstTicks = 0;
+        worstBudgetTicks = 0;
+
+        for (auto& bin : histogram)
+            bin = 0;
+    }
+
+    static double ticksToMs (int64 ticks) noexcept
+    {
+        return Time::highResolutionTicksToSeconds (ticks) * 1000.0;
+    }
+
+    static double toPercent (int64 ticks, int64 budgetTicks) noexcept
+    {
+        return budgetTicks > 0 ? ticks * 100.0 / budgetTicks : 0.0;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NodeLoadStats)
+};
+
+//==============================================================================
+/**
+    Keeps a NodeLoadStats for every node that has been rendered, by node id, and
+    one for the whole graph. A node's figures survive the graph being changed.
+*/
+class NodeLoadProfiler
+{
+public:
+    NodeLoadProfiler()
+        : graphStats (new NodeLoadStats())
+    {}
+
+    /** Message thread: the node's figures, created the first time they're asked for. */
+    NodeLoadStats::Ptr getStatsFor (uint32 nodeId)
+    {
+        const ScopedLock sl (lock);
+
+        const int index = nodeIds.indexOf (nodeId);
+
+        if (index >= 0)
+            return stats.getUnchecked (index);
+
+        nodeIds.add (nodeId);
+        return stats.add (new NodeLoadStats());
+    }
+
+    /** Message thread: nullptr if the node hasn't been rendered yet. */
+    NodeLoadStats::Ptr findStatsFor (uint32 nodeId) const
+    {
+        const ScopedLock sl (lock);
+        return stats[nodeIds.indexOf (nodeId)];
+    }
+
+    NodeLoadStats& getGraphStats() noexcept         { return *graphStats; }
+
+    void resetAll()
+    {
+        const ScopedLock sl (lock);
+
+        for (auto* s : stats)
+            s->reset();
+
+        graphStats->reset();
+    }
+
+    //==============================================================================
+    /** One row per node, plus one for the whole graph. getNodeName gives the name to
+        print for a node id.
+    */
+    template <typename NameFunction>
+    String createCsv (NameFunction&& getNodeName) const
+    {
+        String csv ("node,name,blocks,last ms,average ms,worst ms,last %,average %,worst %,overruns");
+
+        for (int i = 0; i < NodeLoadStats::numBins; ++i)
+            csv << (i < NodeLoadStats::numBins - 1 ? "," + String (i * NodeLoadStats::percentPerBin) + "-" + String ((i + 1) * NodeLoadStats::percentPerBin) + "%"
+                                                  : ",over " + String (i * NodeLoadStats::percentPerBin) + "%");
+
+        csv << newLine << createCsvRow ("graph", "whole graph", *graphStats);
+
+        const ScopedLock sl (lock);
+
+        for (int i = 0; i < stats.size(); ++i)
+            csv << newLine << createCsvRow (String (nodeIds.getUnchecked (i)), getNodeName (nodeIds.getUnchecked (i)), *stats.getUnchecked (i));
+
+        return csv + newLine;
+    }
+
+private:
+    CriticalSection lock;
+    Array<uint32> nodeIds;
+    ReferenceCountedArray<NodeLoadStats> stats;
+    NodeLoadStats::Ptr graphStats;
+
+    static String createCsvRow (const String& id, const String& name, const NodeLoadStats& nodeStats)
+    {
+        const NodeLoadStats::Snapshot s (nodeStats.getSnapshot());
+
+        // names can have commas and quotes in them
+        String row;
+        row << id << "," << name.replace ("\"", "\"\"").quoted()
+            << "," << s.numBlocks
+            << "," << String (s.lastMs, 4) << "," << String (s.averageMs, 4) << "," << String (s.worstMs, 4)
+            << "," << String (s.lastPercent, 2) << "," << String (s.averagePercent, 2) << "," << String (s.worstPercent, 2)
+            << "," << s.numOverruns;
+
+        for (auto count : s.histogram)
+            row << "," << count;
+
+        return row;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NodeLoadProfiler)
+};
@@ -0,0 +1,142 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Maps OSC addresses to parameter indexes.
+
+    The table is compiled once (when a preset is loaded) into an open-addressing
+    hash table keyed on the raw UTF-8 bytes of each address, so a lookup hashes
+    the incoming bytes and compares at most a couple of keys, without building
+    a String or touching the heap.
+
+    Tables are immutable once built, and reference-counted so they can be shared
+    between processors hosting the same ensemble.
+*/
+class OscAddressDispatcher  : public ReferenceCountedObject
+{
+public:
+    typedef ReferenceCountedObjectPtr<OscAddressDispatcher> Ptr;
+
+    /** Compiles a table where addresses[i] resolves to parameter i.
+        Empty addresses are skipped, and the first of any duplicates wins.
+    */
+    OscAddressDispatcher (const StringArray& addresses)
+    {
+        size_t totalKeyBytes = 0;
+
+        for (auto& a : addresses)
+            totalKeyBytes += a.getNumBytesAsUTF8();
+
+        // keep the load factor at or below 0.5 so probe sequences stay short
+        numSlots = 16;
+        while (numSlots < (uint32) addresses.size() * 2)
+            numSlots <<= 1;
+
+        slots.malloc (numSlots);
+
+        for (uint32 i = 0; i < numSlots; ++i)
+            slots[i].parameterIndex = -1;
+
+        keys.malloc (jmax ((size_t) 1, totalKeyBytes));
+        uint32 keyOffset = 0;
+
+        for (int i = 0; i < addresses.size(); ++i)
+        {
+            const String& address = addresses.getReference (i);
+            const size_t length = address.getNumBytesAsUTF8();
+
+            if (length == 0 || find (address.toRawUTF8(), length) >= 0)
+                continue;
+
+            memcpy (keys + keyOffset, address.toRawUTF8(), length);
+
+            const uint32 hash = hashBytes (address.toRawUTF8(), length);
+            uint32 slot = hash & (numSlots - 1);
+
+            while (slots[slot].parameterIndex >= 0)
+                slot = (slot + 1) & (numSlots - 1);
+
+            slots[slot].hash = hash;
+            slots[slot].keyOffset = keyOffset;
+            slots[slot].keyLength = (uint32) length;
+            slots[slot].parameterIndex = i;
+
+            keyOffset += (uint32) length;
+            ++numEntries;
+        }
+    }
+
+    /** Returns the parameter index for an address, or -1 if there isn't one. */
+    int find (const char* address, size_t numBytes) const noexcept
+    {
+        const uint32 hash = hashBytes (address, numBytes);
+
+        for (uint32 slot = hash & (numSlots - 1);; slot = (slot + 1) & (numSlots - 1))
+        {
+            const Slot& s = slots[slot];
+
+            if (s.parameterIndex < 0)
+                return -1;
+
+            if (s.hash == hash && s.keyLength == numBytes
+                 && memcmp (keys + s.keyOffset, address, numBytes) == 0)
+                return s.parameterIndex;
+        }
+    }
+
+    int find (const String& address) const noexcept
+    {
+        return find (address.toRawUTF8(), address.getNumBytesAsUTF8());
+    }
+
+    int getNumEntries() const noexcept      { return numEntries; }
+
+private:
+    struct Slot
+    {
+        uint32 hash, keyOffset, keyLength;
+        int parameterIndex;
+    };
+
+    HeapBlock<Slot> slots;
+    HeapBlock<char> keys;
+    uint32 numSlots = 0;
+    int numEntries = 0;
+
+    // FNV-1a
+    static uint32 hashBytes (const char* data, size_t numBytes) noexcept
+    {
+        uint32 hash = 2166136261u;
+
+        for (size_t i = 0; i < numBytes; ++i)
+            hash = (hash ^ (uint8) data[i]) * 16777619u;
+
+        return hash;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscAddressDispatcher)
+};
@@ -0,0 +1,150 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Collects the messages going to one destination and sends them as a single
+    OSCBundle, either every flushIntervalMs or as soon as maxMessagesPerBundle
+    have been queued, whichever comes first.
+
+    With coalescing on, a message replaces any queued message with the same
+    address, so a fader that moved ten times since the last flush only sends
+    its latest value.
+
+    add() can be called from any thread except the audio thread; flushIfDue()
+    is meant to be called regularly by the OSC sender thread.
+*/
+class OscEgressBatcher
+{
+public:
+    OscEgressBatcher (OSCSender& destination)
+        : sender (destination)
+    {
+    }
+
+    //==============================================================================
+    /** 0, the default, disables batching: every message is sent as soon as it's
+        added, as a message of its own rather than in a bundle.
+    */
+    void setFlushIntervalMs (int ms)                { flushIntervalMs = jmax (0, ms); }
+    int getFlushIntervalMs() const noexcept         { return flushIntervalMs; }
+
+    void setMaxMessagesPerBundle (int max)          { maxMessagesPerBundle = jlimit (1, 1024, max); }
+    int getMaxMessagesPerBundle() const noexcept    { return maxMessagesPerBundle; }
+
+    void setCoalescesAddresses (bool shouldCoalesce)    { coalescesAddresses = shouldCoalesce; }
+    bool getCoalescesAddresses() const noexcept         { return coalescesAddresses; }
+
+    //==============================================================================
+    void add (const OSCMessage& message)
+    {
+        if (flushIntervalMs == 0)
+        {
+            sender.send (message);
+            return;
+        }
+
+        bool isFull;
+
+        {
+            const ScopedLock sl (lock);
+
+            if (pending.isEmpty())
+                firstMessageTime = Time::getMillisecondCounter();
+
+            const String address (message.getAddressPattern().toString());
+
+            if (coalescesAddresses && indexOfAddress.contains (address))
+            {
+                pending.getReference (indexOfAddress[address]) = message;
+            }
+            else
+            {
+                if (coalescesAddresses)
+                    indexOfAddress.set (address, pending.size());
+
+                pending.add (message);
+            }
+
+            isFull = pending.size() >= maxMessagesPerBundle;
+        }
+
+        if (isFull)
+            flush();
+    }
+
+    void flushIfDue()
+    {
+        bool isDue;
+
+        {
+            const ScopedLock sl (lock);
+            isDue = ! pending.isEmpty() && Time::getMillisecondCounter() - firstMessageTime >= (uint32) flushIntervalMs;
+        }
+
+        if (isDue)
+            flush();
+    }
+
+    void flush()
+    {
+        Array<OSCMessage> messages;
+
+        {
+            const ScopedLock sl (lock);
+            messages.swapWith (pending);
+            indexOfAddress.clear();
+        }
+
+        if (messages.size() == 1)
+        {
+            sender.send (messages.getReference (0));
+        }
+        else if (messages.size() > 1)
+        {
+            OSCBundle bundle;
+
+            for (auto& m : messages)
+                bundle.addElement (OSCBundle::Element (m));
+
+            sender.send (bundle);
+        }
+    }
+
+private:
+    OSCSender& sender;
+
+    CriticalSection lock;
+    Array<OSCMessage> pending;
+    HashMap<String, int> indexOfAddress;
+    uint32 firstMessageTime = 0;
+
+    int flushIntervalMs = 0;
+    int maxMessagesPerBundle = 32;
+    bool coalescesAddresses = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscEgressBatcher)
+};
@@ -0,0 +1,135 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Receives UDP datagrams on a thread and hands over the raw bytes.
+
+    This takes the place of OSCReceiver where the bytes themselves are needed:
+    the listener decides whether a packet is parsed (see OscPacketReader) or
+    passed on untouched.
+*/
+class OscInputSocket  : private Thread
+{
+public:
+    struct Listener
+    {
+        virtual ~Listener() {}
+
+        /** Called on the receiver thread. The data is only valid during the call. */
+        virtual void oscDatagramReceived (const char* data, int numBytes) = 0;
+
+        /** Called once no more datagrams are waiting, so any batched work can be finished. */
+        virtual void oscDatagramsDrained() {}
+    };
+
+    OscInputSocket (Listener& l)
+        : Thread ("OSC input"), listener (l)
+    {
+    }
+
+    ~OscInputSocket()
+    {
+        disconnect();
+    }
+
+    /** Does nothing if it's already listening on this port. */
+    bool connect (int portNumber)
+    {
+        if (socket != nullptr && portNumber == boundPort)
+            return true;
+
+        disconnect();
+
+        socket = new DatagramSocket (false);
+
+        if (! socket->bindToPort (portNumber))
+        {
+            socket = nullptr;
+            return false;
+        }
+
+        boundPort = portNumber;
+        startThread (8);
+        return true;
+    }
+
+    bool disconnect()
+    {
+        if (socket == nullptr)
+            return true;
+
+        // the thread never blocks for more than waitTimeoutMs, so it stops promptly
+        stopThread (2000);
+        socket = nullptr;
+        return true;
+    }
+
+    bool isConnected() const noexcept       { return socket != nullptr; }
+
+private:
+    enum { maxDatagramSize = 65507, waitTimeoutMs = 100 };
+
+    Listener& listener;
+    ScopedPointer<DatagramSocket> socket;
+    int boundPort = 0;
+
+    void run() override
+    {
+        HeapBlock<char> buffer ((size_t) maxDatagramSize);
+        bool hasUndrainedData = false;
+
+        while (! threadShouldExit())
+        {
+            // don't wait if there might be more to read straight away
+            const int ready = socket->waitUntilReady (true, hasUndrainedData ? 0 : waitTimeoutMs);
+
+            if (ready < 0)
+                break;
+
+            if (ready == 0)
+            {
+                if (hasUndrainedData)
+                {
+                    listener.oscDatagramsDrained();
+                    hasUndrainedData = false;
+                }
+
+                continue;
+            }
+
+            const int numBytes = socket->read (buffer, maxDatagramSize, false);
+
+            if (numBytes > 0)
+            {
+                listener.oscDatagramReceived (buffer, numBytes);
+                hasUndrainedData = true;
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscInputSocket)
+};
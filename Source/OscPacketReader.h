@@ -0,0 +1,230 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Reads OSC 1.0 packets straight from a UDP datagram.
+
+    The static helpers look at a packet in place (is it a bundle, what are its
+    message addresses) without copying anything, so a packet can be routed
+    before deciding whether it's worth parsing. readPacket() then builds the
+    usual juce OSCMessage / OSCBundle objects, and like the juce OSC classes it
+    throws an OSCFormatError if the data is malformed.
+*/
+class OscPacketReader
+{
+public:
+    OscPacketReader (const char* packetData, int packetSize) noexcept
+        : data (packetData), size (packetSize)
+    {
+    }
+
+    //==============================================================================
+    static bool isBundle (const char* d, int s) noexcept
+    {
+        return s >= 16 && memcmp (d, "#bundle", 8) == 0;
+    }
+
+    /** Returns the length of the address at the start of a message packet,
+        or -1 if this isn't a well-formed message.
+    */
+    static int getAddressLength (const char* d, int s) noexcept
+    {
+        if (s < 4 || d[0] != '/')
+            return -1;
+
+        for (int i = 1; i < s; ++i)
+            if (d[i] == 0)
+                return i;
+
+        return -1;
+    }
+
+    /** Calls visitor (const char* address, int length) for each message in the packet,
+        descending into nested bundles, until the visitor returns false.
+        Returns false if the visitor stopped early or the packet is malformed.
+    */
+    template <typename Visitor>
+    static bool visitAddresses (const char* d, int s, Visitor&& visitor)
+    {
+        if (! isBundle (d, s))
+        {
+            const int length = getAddressLength (d, s);
+            return length > 0 && visitor (d, length);
+        }
+
+        int pos = 16;
+
+        while (pos < s)
+        {
+            if (pos + 4 > s)
+                return false;
+
+            const int elementSize = (int) ByteOrder::bigEndianInt (d + pos);
+            pos += 4;
+
+            if (elementSize <= 0 || elementSize > s - pos)
+                return false;
+
+            if (! visitAddresses (d + pos, elementSize, visitor))
+                return false;
+
+            pos += elementSize;
+        }
+
+        return true;
+    }
+
+    //==============================================================================
+    /** Parses the whole packet, passing the result to either
+        target.oscMessageReceived() or target.oscBundleReceived().
+    */
+    template <typename Target>
+    void readPacket (Target& target)
+    {
+        if (isBundle (data, size))
+            target.oscBundleReceived (readBundle (size));
+        else
+            target.oscMessageReceived (readMessage (size));
+    }
+
+private:
+    const char* data;
+    int size, pos = 0;
+
+    void checkAvailable (int numBytes) const
+    {
+        if (numBytes < 0 || pos + numBytes > size)
+            throw OSCFormatError ("OSC input stream exhausted while reading packet");
+    }
+
+    int32 readInt32()
+    {
+        checkAvailable (4);
+        const int32 value = (int32) ByteOrder::bigEndianInt (data + pos);
+        pos += 4;
+        return value;
+    }
+
+    uint64 readUint64()
+    {
+        checkAvailable (8);
+        const uint64 value = ((uint64) ByteOrder::bigEndianInt (data + pos) << 32) | ByteOrder::bigEndianInt (data + pos + 4);
+        pos += 8;
+        return value;
+    }
+
+    float readFloat32()
+    {
+        union { int32 i; float f; } u;
+        u.i = readInt32();
+        return u.f;
+    }
+
+    String readString()
+    {
+        const char* start = data + pos;
+        int length = 0;
+
+        while (pos + length < size && start[length] != 0)
+            ++length;
+
+        checkAvailable (length + 1);
+        pos = jmin (size, pos + ((length + 4) & ~3));
+
+        return String::fromUTF8 (start, length);
+    }
+
+    MemoryBlock readBlob()
+    {
+        const int blobSize = readInt32();
+        checkAvailable (blobSize);
+
+        MemoryBlock blob (data + pos, (size_t) blobSize);
+        pos = jmin (size, pos + ((blobSize + 3) & ~3));
+        return blob;
+    }
+
+    OSCMessage readMessage (int messageSize)
+    {
+        const int end = pos + messageSize;
+        OSCMessage message (OSCAddressPattern (readString()));
+
+        // a message may have no type tag string at all
+        if (pos >= end || data[pos] != ',')
+            return message;
+
+        const String typeTags (readString());
+
+        for (int i = 1; i < typeTags.length(); ++i)
+        {
+            switch (typeTags[i])
+            {
+                case 'i':   message.addInt32 (readInt32()); break;
+                case 'f':   message.addFloat32 (readFloat32()); break;
+                case 's':   message.addString (readString()); break;
+                case 'b':   message.addBlob (readBlob()); break;
+                default:    throw OSCFormatError ("OSC input stream: unsupported argument type");
+            }
+        }
+
+        return message;
+    }
+
+    OSCBundle readBundle (int bundleSize)
+    {
+        const int end = pos + bundleSize;
+
+        checkAvailable (16);
+
+        if (memcmp (data + pos, "#bundle", 8) != 0)
+            throw OSCFormatError ("OSC input stream: bundle doesn't start with #bundle");
+
+        pos += 8;
+        OSCBundle bundle (OSCTimeTag (readUint64()));
+
+        while (pos < end)
+        {
+            const int elementSize = readInt32();
+
+            if (elementSize <= 0 || pos + elementSize > end)
+                throw OSCFormatError ("OSC input stream: bad bundle element size");
+
+            const int elementEnd = pos + elementSize;
+
+            if (isBundle (data + pos, elementSize))
+                bundle.addElement (OSCBundle::Element (readBundle (elementSize)));
+            else
+                bundle.addElement (OSCBundle::Element (readMessage (elementSize)));
+
+            pos = elementEnd;
+        }
+
+        return bundle;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (OscPacketReader)
+};
@@ -0,0 +1,276 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+ #include <sys/socket.h>
+ #include <netdb.h>
+ #include <unistd.h>
+#endif
+
+
+//==============================================================================
+/** A host and UDP port that OSC is sent to. */
+struct OscDestination
+{
+    String host;
+    int port;
+
+    bool operator== (const OscDestination& other) const noexcept    { return port == other.port && host == other.host; }
+    bool operator!= (const OscDestination& other) const noexcept    { return ! operator== (other); }
+
+    String toString() const                         { return host + ":" + String (port); }
+
+    /** Parses "host:port", returning a port of 0 if the string isn't valid. */
+    static OscDestination fromString (const String& s)
+    {
+        OscDestination d = { s.upToLastOccurrenceOf (":", false, false).trim(),
+                             s.fromLastOccurrenceOf (":", false, false).getIntValue() };
+
+        if (d.host.isEmpty() || d.port <= 0 || d.port > 65535)
+            d.port = 0;
+
+        return d;
+    }
+};
+
+//==============================================================================
+/**
+    Forwards OSC datagrams to a list of destinations exactly as they were
+    received, without parsing them or encoding them again.
+
+    On Linux, datagrams are collected into a batch and sent to every destination
+    with a single sendmmsg() call once the input socket has been drained (or the
+    batch is full). Elsewhere each datagram is written straight from the receive
+    buffer.
+
+    Each datagram is sent to a subset of the destinations, given as a bitmask of
+    their indexes (see OscRoutingTable::findDestinations()).
+
+    relay(), flush() and setDestinations() must be called from one thread,
+    normally the OSC input thread.
+*/
+class OscRelay
+{
+public:
+    OscRelay()
+    {
+       #if JUCE_LINUX
+        socketHandle = ::socket (AF_INET, SOCK_DGRAM, 0);
+        batchData.malloc ((size_t) batchDataSize);
+        messageHeaders.calloc ((size_t) (maxBatchSize * maxDestinations));
+        ioVectors.calloc ((size_t) (maxBatchSize * maxDestinations));
+       #endif
+    }
+
+    ~OscRelay()
+    {
+       #if JUCE_LINUX
+        if (socketHandle >= 0)
+            ::close (socketHandle);
+       #endif
+    }
+
+    //==============================================================================
+    /** The destinations keep their positions, so bit n of a mask always means newDestinations[n]. */
+    void setDestinations (const Array<OscDestination>& newDestinations)
+    {
+        Array<OscDestination> valid (newDestinations);
+        valid.removeRange (maxDestinations, valid.size());
+
+       #if JUCE_LINUX
+        // names are resolved here rather than for every datagram; one that
+        // can't be resolved keeps its slot, with a port of 0 so it's skipped
+        Array<sockaddr_in> addresses;
+
+        for (auto& d : valid)
+        {
+            sockaddr_in address;
+
+            if (! resolve (d, address))
+                zerostruct (address);
+
+            addresses.add (address);
+        }
+
+        // what's already batched was addressed using the old indexes
+        flush();
+       #else
+        OwnedArray<DatagramSocket> sockets;
+
+        for (int i = 0; i < valid.size(); ++i)
+            sockets.add (new DatagramSocket (false));
+       #endif
+
+        const ScopedLock sl (lock);
+        destinations.swapWith (valid);
+
+       #if JUCE_LINUX
+        destinationAddresses.swapWith (addresses);
+       #else
+        destinationSockets.swapWith (sockets);
+       #endif
+    }
+
+    Array<OscDestination> getDestinations() const
+    {
+        const ScopedLock sl (lock);
+        return destinations;
+    }
+
+    //==============================================================================
+    void relay (const char* data, int numBytes, uint32 destinationMask)
+    {
+        if (destinationMask == 0)
+            return;
+
+       #if JUCE_LINUX
+        if (numPending == maxBatchSize || batchDataUsed + numBytes > batchDataSize)
+            flush();
+
+        if (numBytes > batchDataSize)
+            return;
+
+        memcpy (batchData + batchDataUsed, data, (size_t) numBytes);
+        pendingOffsets[numPending] = batchDataUsed;
+        pendingSizes[numPending] = numBytes;
+        pendingMasks[numPending] = destinationMask;
+        batchDataUsed += numBytes;
+        ++numPending;
+       #else
+        const ScopedLock sl (lock);
+
+        for (int i = 0; i < destinations.size(); ++i)
+            if ((destinationMask & (1u << i)) != 0 && destinations.getReference (i).port > 0)
+                destinationSockets.getUnchecked (i)->write (destinations.getReference (i).host, destinations.getReference (i).port,
+                                                            data, numBytes);
+
+        ++numRelayed;
+       #endif
+    }
+
+    /** Sends whatever has been batched up. */
+    void flush()
+    {
+       #if JUCE_LINUX
+        if (numPending == 0)
+            return;
+
+        {
+            const ScopedLock sl (lock);
+            int numMessages = 0;
+
+            for (int d = 0; d < destinationAddresses.size(); ++d)
+            {
+                sockaddr_in& address = destinationAddresses.getReference (d);
+
+                if (address.sin_port == 0)
+                    continue;
+
+                for (int i = 0; i < numPending; ++i)
+                {
+                    if ((pendingMasks[i] & (1u << d)) == 0)
+                        continue;
+
+                    iovec& v = ioVectors[numMessages];
+                    v.iov_base = batchData + pendingOffsets[i];
+                    v.iov_len = (size_t) pendingSizes[i];
+
+                    mmsghdr& h = messageHeaders[numMessages];
+                    zerostruct (h);
+                    h.msg_hdr.msg_name = &address;
+                    h.msg_hdr.msg_namelen = sizeof (sockaddr_in);
+                    h.msg_hdr.msg_iov = &v;
+                    h.msg_hdr.msg_iovlen = 1;
+
+                    ++numMessages;
+                }
+            }
+
+            // UDP is lossy anyway, so a failed send is dropped rather than retried
+            for (int sent = 0; sent < numMessages;)
+            {
+                const int result = ::sendmmsg (socketHandle, messageHeaders + sent, (unsigned int) (numMessages - sent), 0);
+
+                if (result <= 0)
+                    break;
+
+                sent += result;
+            }
+        }
+
+        numRelayed += numPending;
+        numPending = 0;
+        batchDataUsed = 0;
+       #endif
+    }
+
+    int64 getNumDatagramsRelayed() const noexcept   { return numRelayed.get(); }
+
+private:
+    enum
+    {
+        maxDestinations = 32,
+        maxBatchSize = 64,
+        batchDataSize = 256 * 1024
+    };
+
+    CriticalSection lock;
+    Array<OscDestination> destinations;
+    Atomic<int64> numRelayed;
+
+   #if JUCE_LINUX
+    int socketHandle = -1;
+    Array<sockaddr_in> destinationAddresses;
+
+    HeapBlock<char> batchData;
+    int batchDataUsed = 0, numPending = 0;
+    int pendingOffsets[maxBatchSize], pendingSizes[maxBatchSize];
+    uint32 pendingMasks[maxBatchSize];
+
+    HeapBlock<mmsghdr> messageHeaders;
+    HeapBlock<iovec> ioVectors;
+
+    static bool resolve (const OscDestination& d, sockaddr_in& result)
+    {
+        addrinfo hints;
+        zerostruct (hints);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        addrinfo* info = nullptr;
+
+        if (getaddrinfo (d.host.toRawUTF8(), String (d.port).toRawUTF8(), &hints, &info) != 0 || info == nullptr)
+            return false;
+
+        memcpy (&result, info->ai_addr, sizeof (sockaddr_in));
+        freeaddrinfo (info);
+        return true;
+    }
+   #else
+    OwnedArray<DatagramSocket> destinationSockets;
+   #endif
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscRelay)
+};
@@ -0,0 +1,203 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscRoutingTable.h"
+#include "OscEgressBatcher.h"
+#include "OscPacketReader.h"
+
+
+//==============================================================================
+/**
+    Sends all outgoing OSC according to an OscRoutingTable.
+
+    Each destination gets one OSCSender and one OscEgressBatcher, created when
+    it first appears in a table and kept for as long as a table uses it, so
+    changing the routes or restarting the audio doesn't reopen sockets.
+
+    send() and flushIfDue() can be called from any thread except the audio
+    thread. relay() and flushRelay() belong to the OSC input thread.
+*/
+class OscRouter
+{
+public:
+    OscRouter()
+    {
+        setRoutingTable (OscRoutingTable::createDefault());
+    }
+
+    ~OscRouter()
+    {
+        flush();
+    }
+
+    //==============================================================================
+    void setRoutingTable (OscRoutingTable::Ptr newTable)
+    {
+        jassert (newTable != nullptr);
+
+        const ScopedLock sl (lock);
+        OwnedArray<Output> newOutputs;
+
+        for (auto& d : newTable->getDestinations())
+        {
+            Output* output = nullptr;
+
+            for (auto* o : outputs)
+            {
+                if (o->destination == d)
+                {
+                    output = outputs.removeAndReturn (outputs.indexOf (o));
+                    break;
+                }
+            }
+
+            if (output == nullptr)
+                output = new Output (d);
+
+            applyBatchingSettings (*output);
+            newOutputs.add (output);
+        }
+
+        // whatever is left has been dropped from the table
+        for (auto* o : outputs)
+            o->batcher.flush();
+
+        outputs.swapWith (newOutputs);
+        table = newTable;
+    }
+
+    OscRoutingTable::Ptr getRoutingTable() const
+    {
+        const ScopedLock sl (lock);
+        return table;
+    }
+
+    //==============================================================================
+    /** Forwarded messages are batched into a bundle per destination, flushed every
+        flushIntervalMs (0 sends them straight away) or once maxMessages are queued.
+        With coalescing, only the latest message per address is sent in each bundle.
+        Batching is off until this turns it on, so receivers that don't expect
+        bundles keep working.
+    */
+    void setEgressBatching (int newFlushIntervalMs, int newMaxMessages, bool shouldCoalesce)
+    {
+        const ScopedLock sl (lock);
+        flushIntervalMs = jmax (0, newFlushIntervalMs);
+        maxMessagesPerBundle = jlimit (1, 1024, newMaxMessages);
+        coalescesAddresses = shouldCoalesce;
+
+        for (auto* o : outputs)
+            applyBatchingSettings (*o);
+    }
+
+    int getFlushIntervalMs() const noexcept         { return flushIntervalMs; }
+    int getMaxMessagesPerBundle() const noexcept    { return maxMessagesPerBundle; }
+    bool getCoalescesAddresses() const noexcept     { return coalescesAddresses; }
+
+    //==============================================================================
+    void send (const OSCMessage& message)
+    {
+        const ScopedLock sl (lock);
+        const uint32 mask = table->findDestinations (message.getAddressPattern().toString());
+
+        for (int i = 0; i < outputs.size(); ++i)
+            if ((mask & (1u << i)) != 0)
+                outputs.getUnchecked (i)->batcher.add (message);
+    }
+
+    void flushIfDue()
+    {
+        const ScopedLock sl (lock);
+
+        for (auto* o : outputs)
+            o->batcher.flushIfDue();
+    }
+
+    void flush()
+    {
+        const ScopedLock sl (lock);
+
+        for (auto* o : outputs)
+            o->batcher.flush();
+    }
+
+    //==============================================================================
+    /** Forwards a raw packet to the union of the destinations of its addresses. */
+    void relay (const char* data, int numBytes)
+    {
+        OscRoutingTable::Ptr currentTable (getRoutingTable());
+
+        if (currentTable != relayTable)
+        {
+            relayTable = currentTable;
+            oscRelay.setDestinations (relayTable->getDestinations());
+        }
+
+        uint32 mask = 0;
+
+        OscPacketReader::visitAddresses (data, numBytes, [&] (const char* address, int length)
+        {
+            mask |= relayTable->findDestinations (address, length);
+            return true;
+        });
+
+        oscRelay.relay (data, numBytes, mask);
+    }
+
+    void flushRelay()           { oscRelay.flush(); }
+
+private:
+    struct Output
+    {
+        Output (const OscDestination& d)
+            : destination (d), batcher (sender)
+        {
+            sender.connect (d.host, d.port);
+        }
+
+        const OscDestination destination;
+        OSCSender sender;
+        OscEgressBatcher batcher;
+    };
+
+    CriticalSection lock;
+    OscRoutingTable::Ptr table;
+    OwnedArray<Output> outputs;
+
+    int flushIntervalMs = 0, maxMessagesPerBundle = 32;
+    bool coalescesAddresses = false;
+
+    // only touched by the OSC input thread
+    OscRoutingTable::Ptr relayTable;
+    OscRelay oscRelay;
+
+    void applyBatchingSettings (Output& o)
+    {
+        o.batcher.setFlushIntervalMs (flushIntervalMs);
+        o.batcher.setMaxMessagesPerBundle (maxMessagesPerBundle);
+        o.batcher.setCoalescesAddresses (coalescesAddresses);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscRouter)
+};
@@ -0,0 +1,221 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscRelay.h"
+
+
+//==============================================================================
+/**
+    Decides where forwarded OSC goes: each route maps an address prefix to a set
+    of destinations, and the longest matching prefix wins. An empty prefix (or
+    "/") catches everything no other route matches.
+
+    Prefixes match whole address segments: "/ctrl" matches "/ctrl" and
+    "/ctrl/1" but not "/ctrlFoo", and a prefix ending in '/' matches anything
+    below it.
+
+    The routes are compiled into a prefix tree when the table is built, and a
+    table is never changed afterwards, so lookups need no locking and don't
+    allocate. Destination sets come back as a bitmask of indexes into
+    getDestinations().
+*/
+class OscRoutingTable  : public ReferenceCountedObject
+{
+public:
+    typedef ReferenceCountedObjectPtr<OscRoutingTable> Ptr;
+
+    enum { maxDestinations = 32 };
+
+    struct Route
+    {
+        String prefix;
+        Array<OscDestination> destinations;
+    };
+
+    //==============================================================================
+    OscRoutingTable (const Array<Route>& routesToUse)
+        : routes (routesToUse)
+    {
+        nodes.add (Node());
+
+        for (auto& route : routes)
+        {
+            uint32 mask = 0;
+
+            for (auto& d : route.destinations)
+            {
+                if (d.port <= 0)
+                    continue;
+
+                int index = destinations.indexOf (d);
+
+                if (index < 0 && destinations.size() < maxDestinations)
+                {
+                    index = destinations.size();
+                    destinations.add (d);
+                }
+
+                if (index >= 0)
+                    mask |= (1u << index);
+            }
+
+            addPrefix (route.prefix == "/" ? String() : route.prefix, mask);
+        }
+    }
+
+    /** What the host always did: forwarded messages go to P5 and the mixer, and
+        the host's own replies (/ctrl, /enable, /cacheStats, /poolStats) only to P5.
+    */
+    static Ptr createDefault()
+    {
+        const OscDestination p5 = { "127.0.0.1", 9000 };
+        const OscDestination mixer = { "127.0.0.1", 10000 };
+
+        Array<Route> routes;
+        routes.add ({ String(), { p5, mixer } });
+
+        for (auto* prefix : { "/ctrl", "/enable", "/cacheStats", "/poolStats" })
+            routes.add ({ prefix, { p5 } });
+
+        return new OscRoutingTable (routes);
+    }
+
+    //==============================================================================
+    /** Returns the destinations for an address, as bits indexing getDestinations(). */
+    uint32 findDestinations (const char* address, int length) const noexcept
+    {
+        const Node* node = nodes.begin();
+        uint32 result = node->hasRoute ? node->destinations : 0;
+
+        for (int i = 0; i < length; ++i)
+        {
+            int child = node->firstChild;
+
+            while (child >= 0 && nodes.getReference (child).character != address[i])
+                child = nodes.getReference (child).nextSibling;
+
+            if (child < 0)
+                break;
+
+            node = nodes.begin() + child;
+
+            if (node->hasRoute && (i + 1 == length || address[i + 1] == '/' || address[i] == '/'))
+                result = node->destinations;
+        }
+
+        return result;
+    }
+
+    uint32 findDestinations (const String& address) const noexcept
+    {
+        return findDestinations (address.toRawUTF8(), (int) address.getNumBytesAsUTF8());
+    }
+
+    const Array<OscDestination>& getDestinations() const noexcept     { return destinations; }
+    const Array<Route>& getRoutes() const noexcept                    { return routes; }
+
+    //==============================================================================
+    XmlElement* createXml() const
+    {
+        XmlElement* xml = new XmlElement ("OSC_ROUTES");
+
+        for (auto& route : routes)
+        {
+            StringArray names;
+
+            for (auto& d : route.destinations)
+                names.add (d.toString());
+
+            XmlElement* e = xml->createNewChildElement ("ROUTE");
+            e->setAttribute ("prefix", route.prefix);
+            e->setAttribute ("destinations", names.joinIntoString (","));
+        }
+
+        return xml;
+    }
+
+    static Ptr fromXml (const XmlElement& xml)
+    {
+        Array<Route> routes;
+
+        forEachXmlChildElementWithTagName (xml, e, "ROUTE")
+        {
+            Route route;
+            route.prefix = e->getStringAttribute ("prefix");
+
+            for (auto& d : StringArray::fromTokens (e->getStringAttribute ("destinations"), ",", ""))
+                route.destinations.add (OscDestination::fromString (d));
+
+            routes.add (route);
+        }
+
+        return new OscRoutingTable (routes);
+    }
+
+private:
+    struct Node
+    {
+        char character = 0;
+        int firstChild = -1, nextSibling = -1;
+        uint32 destinations = 0;
+        bool hasRoute = false;
+    };
+
+    Array<Route> routes;
+    Array<OscDestination> destinations;
+    Array<Node> nodes;
+
+    void addPrefix (const String& prefix, uint32 mask)
+    {
+        const char* p = prefix.toRawUTF8();
+        int node = 0;
+
+        for (; *p != 0; ++p)
+        {
+            int child = nodes.getReference (node).firstChild;
+
+            while (child >= 0 && nodes.getReference (child).character != *p)
+                child = nodes.getReference (child).nextSibling;
+
+            if (child < 0)
+            {
+                Node n;
+                n.character = *p;
+                n.nextSibling = nodes.getReference (node).firstChild;
+
+                child = nodes.size();
+                nodes.add (n);
+                nodes.getReference (node).firstChild = child;
+            }
+
+            node = child;
+        }
+
+        // a prefix given twice takes the later route
+        nodes.getReference (node).destinations = mask;
+        nodes.getReference (node).hasRoute = true;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscRoutingTable)
+};
@@ -0,0 +1,176 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RealtimeFifo.h"
+#include <chrono>
+
+
+//==============================================================================
+/**
+    Works out when each audio block starts, in Time::getMillisecondCounterHiRes()
+    terms, so that a point in time can be turned into a sample position.
+
+    Audio callbacks don't arrive exactly on time, so the start of each block is
+    predicted from the previous one and the number of samples played, and only
+    nudged towards the measured time. When the host's playhead jumps (a loop or
+    a seek), or the callbacks stall, the estimate starts again from the clock.
+*/
+class SampleClock
+{
+public:
+    SampleClock() {}
+
+    /** Call at the top of each block, on the audio thread. */
+    void blockStarted (double nowMs, int numSamples, double sampleRate,
+                       int64 timelinePosition, bool hasTimeline) noexcept
+    {
+        const double predictedMs = blockStartMs + lastBlockSize * 1000.0 / currentSampleRate;
+
+        const bool timelineJumped = hasTimeline && (! hadTimeline || timelinePosition != lastTimelinePosition + lastBlockSize);
+
+        if (! isRunning || timelineJumped || sampleRate != currentSampleRate
+             || std::abs (nowMs - predictedMs) > resetThresholdMs)
+            blockStartMs = nowMs;
+        else
+            blockStartMs = predictedMs + (nowMs - predictedMs) * correctionAmount;
+
+        isRunning = true;
+        currentSampleRate = sampleRate;
+        lastBlockSize = numSamples;
+        lastTimelinePosition = timelinePosition;
+        hadTimeline = hasTimeline;
+    }
+
+    /** The position of a time relative to the start of the current block,
+        in samples. Negative if it has already gone by.
+    */
+    double getSampleOffset (double timeMs) const noexcept
+    {
+        return (timeMs - blockStartMs) * currentSampleRate / 1000.0;
+    }
+
+    //==============================================================================
+    /** Converts an OSC time tag to Time::getMillisecondCounterHiRes() terms,
+        or returns 0 if the tag means "immediately".
+    */
+    static double timeTagToMillisecondCounter (const OSCTimeTag& tag)
+    {
+        if (tag.isImmediately())
+            return 0.0;
+
+        const uint64 raw = tag.getRawTimeTag();
+        const double secondsSince1900 = (double) (raw >> 32) + (double) (raw & 0xffffffff) / 4294967296.0;
+        const double unixMs = (secondsSince1900 - 2208988800.0) * 1000.0;
+
+        // Time::currentTimeMillis() is too coarse for this
+        const double nowUnixMs = std::chrono::duration<double, std::milli> (std::chrono::system_clock::now().time_since_epoch()).count();
+
+        return unixMs - nowUnixMs + Time::getMillisecondCounterHiRes();
+    }
+
+private:
+    static constexpr double correctionAmount = 0.02;
+    static constexpr double resetThresholdMs = 50.0;
+
+    double blockStartMs = 0, currentSampleRate = 44100.0;
+    int lastBlockSize = 0;
+    int64 lastTimelinePosition = 0;
+    bool isRunning = false, hadTimeline = false;
+
+    JUCE_DECLARE_NON_COPYABLE (SampleClock)
+};
+
+//==============================================================================
+/** A parameter change that should happen at a given time rather than straight away. */
+struct ScheduledParameterChange
+{
+    double dueTimeMs;
+    int parameterIndex;
+    float value;
+};
+
+//==============================================================================
+/**
+    Holds future-dated parameter changes until the block they fall in.
+
+    The OSC thread adds changes through a fifo; the audio thread keeps the ones
+    that aren't due yet in a fixed-size list, so nothing allocates once it's
+    been created.
+*/
+class OscScheduler
+{
+public:
+    OscScheduler()
+        : incoming (capacity)
+    {
+        pending.malloc ((size_t) capacity);
+    }
+
+    /** Called from the OSC thread. Returns false if the queue is full. */
+    bool schedule (int parameterIndex, float value, double dueTimeMs) noexcept
+    {
+        ScheduledParameterChange change = { dueTimeMs, parameterIndex, value };
+        return incoming.push (change);
+    }
+
+    /** Called on the audio thread: calls callback (parameterIndex, value, sampleOffset)
+        for every change that falls before the end of this block, in the order they
+        were scheduled. Changes that are already late get an offset of 0.
+
+        The callback returns false if it has no room for the change, which is then
+        kept, and offered again (late) in the next block.
+    */
+    template <typename Callback>
+    void popDueChanges (const SampleClock& clock, int numSamples, Callback&& callback) noexcept
+    {
+        ScheduledParameterChange change;
+
+        while (numPending < capacity && incoming.pop (change))
+            pending[numPending++] = change;
+
+        int numKept = 0;
+
+        for (int i = 0; i < numPending; ++i)
+        {
+            const ScheduledParameterChange& c = pending[i];
+            const double offset = clock.getSampleOffset (c.dueTimeMs);
+
+            if (offset >= numSamples || ! callback (c.parameterIndex, c.value, jmax (0, (int) offset)))
+                pending[numKept++] = c;
+        }
+
+        numPending = numKept;
+    }
+
+    int getNumPending() const noexcept      { return numPending; }
+
+private:
+    enum { capacity = 4096 };
+
+    RealtimeFifo<ScheduledParameterChange> incoming;
+    HeapBlock<ScheduledParameterChange> pending;
+    int numPending = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscScheduler)
+};
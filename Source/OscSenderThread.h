@@ -0,0 +1,93 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RealtimeFifo.h"
+#include "OscRouter.h"
+
+
+//==============================================================================
+/** A MIDI controller change to be forwarded as "/ctrl number value instance". */
+struct OutgoingControllerEvent
+{
+    int controllerNumber;
+    int controllerValue;
+    int instanceNumber;
+};
+
+//==============================================================================
+/**
+    Sends OSC on behalf of the audio thread.
+
+    The audio thread only writes plain structs into a fifo; this thread turns
+    them into OSC messages and does the socket calls. It polls every
+    millisecond rather than being woken, because signalling an event from the
+    audio thread can take a lock.
+
+    It also flushes the router's batchers when their interval is up.
+*/
+class OscSenderThread  : private Thread
+{
+public:
+    OscSenderThread (OscRouter& routerToUse)
+        : Thread ("OSC sender"), router (routerToUse), controllerEvents (eventQueueSize)
+    {
+        startThread (7);
+    }
+
+    ~OscSenderThread()
+    {
+        stopThread (2000);
+        router.flush();
+    }
+
+    /** Realtime-safe. Returns false if the fifo was full and the event was dropped. */
+    bool pushControllerEvent (int controllerNumber, int controllerValue, int instanceNumber) noexcept
+    {
+        OutgoingControllerEvent e = { controllerNumber, controllerValue, instanceNumber };
+        return controllerEvents.push (e);
+    }
+
+private:
+    enum { eventQueueSize = 4096 };
+
+    OscRouter& router;
+    RealtimeFifo<OutgoingControllerEvent> controllerEvents;
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            OutgoingControllerEvent e;
+
+            while (controllerEvents.pop (e))
+                router.send (OSCMessage ("/ctrl", e.controllerNumber, e.controllerValue, e.instanceNumber));
+
+            router.flushIfDue();
+
+            wait (1);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscSenderThread)
+};
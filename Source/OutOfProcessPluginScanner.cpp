@@ -0,0 +1,340 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OutOfProcessPluginScanner.h"
+
+
+//==============================================================================
+// Requests and replies are sent as one-line XML documents:
+//   <SCAN format="VST" file="..."/>   ->   <SCANNED knownFormat="1"><PLUGIN .../>...</SCANNED>
+static MemoryBlock xmlToMessage (const XmlElement& xml)
+{
+    const String text (xml.createDocument (String(), true, false));
+    return MemoryBlock (text.toRawUTF8(), text.getNumBytesAsUTF8());
+}
+
+static XmlElement* messageToXml (const MemoryBlock& message)
+{
+    return XmlDocument::parse (message.toString());
+}
+
+//==============================================================================
+class OutOfProcessPluginScanner::Worker
+{
+public:
+    Worker() : master (new Master (*this)) {}
+
+    enum Result
+    {
+        scanned,
+        unknownFormat,  // the worker doesn't have this format, so it has to be scanned here
+        notSent,        // the worker was already broken, before the plugin was touched
+        cancelled,
+        died
+    };
+
+    bool launch()
+    {
+        return master->launchSlaveProcess (File::getSpecialLocation (File::currentExecutableFile),
+                                           PluginScannerWorker::commandLineUID, 10000);
+    }
+
+    bool isAlive() const noexcept       { return connectionLost.get() == 0; }
+
+    Result scan (const OutOfProcessPluginScanner& scanner, AudioPluginFormat& format,
+                 const String& fileOrIdentifier, OwnedArray<PluginDescription>& result)
+    {
+        replyReceived.reset();
+
+        {
+            const ScopedLock sl (lock);
+            reply.reset();
+        }
+
+        XmlElement request ("SCAN");
+        request.setAttribute ("format", format.getName());
+        request.setAttribute ("file", fileOrIdentifier);
+
+        if (! isAlive() || ! master->sendMessageToSlave (xmlToMessage (request)))
+            return notSent;
+
+        // the worker kills itself after scanTimeoutMs, so this only runs out if that fails too
+        const uint32 startTime = Time::getMillisecondCounter();
+
+        while (! replyReceived.wait (100))
+        {
+            if (scanner.shouldExit())
+                return cancelled;
+
+            if (Time::getMillisecondCounter() - startTime > (uint32) OutOfProcessPluginScanner::scanTimeoutMs + 5000)
+                return died;
+        }
+
+        if (! isAlive())
+            return died;
+
+        ScopedPointer<XmlElement> xml;
+
+        {
+            const ScopedLock sl (lock);
+            xml = messageToXml (reply);
+        }
+
+        if (xml == nullptr || ! xml->hasTagName ("SCANNED"))
+            return died;
+
+        if (! xml->getBoolAttribute ("knownFormat"))
+            return unknownFormat;
+
+        forEachXmlChildElement (*xml, e)
+        {
+            PluginDescription desc;
+
+            if (desc.loadFromXml (*e))
+                result.add (new PluginDescription (desc));
+        }
+
+        return scanned;
+    }
+
+private:
+    // the connection calls back on its own thread, so it mustn't outlive the members it uses
+    struct Master  : public ChildProcessMaster
+    {
+        Master (Worker& w) : owner (w) {}
+
+        void handleMessageFromSlave (const MemoryBlock& m) override
+        {
+            {
+                const ScopedLock sl (owner.lock);
+                owner.reply = m;
+            }
+
+            owner.replyReceived.signal();
+        }
+
+        void handleConnectionLost() override
+        {
+            owner.connectionLost = 1;
+            owner.replyReceived.signal();
+        }
+
+        Worker& owner;
+    };
+
+    CriticalSection lock;
+    MemoryBlock reply;
+    WaitableEvent replyReceived;
+    Atomic<int> connectionLost;
+
+    ScopedPointer<Master> master;
+
+    JUCE_DECLARE_NON_COPYABLE (Worker)
+};
+
+//==============================================================================
+OutOfProcessPluginScanner::OutOfProcessPluginScanner() {}
+OutOfProcessPluginScanner::~OutOfProcessPluginScanner() {}
+
+int OutOfProcessPluginScanner::getNumScanningThreads()
+{
+    return jmax (1, SystemStats::getNumCpus());
+}
+
+bool OutOfProcessPluginScanner::findPluginTypesFor (AudioPluginFormat& format, OwnedArray<PluginDescription>& result,
+                                                    const String& fileOrIdentifier)
+{
+    // a worker can die of something other than the plugin, so the file is only
+    // blacklisted if it takes a fresh worker down as well
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        ScopedPointer<Worker> worker (attempt == 0 ? takeIdleWorker() : launchWorker());
+        Worker::Result scanResult = Worker::notSent;
+
+        if (worker != nullptr)
+            scanResult = worker->scan (*this, format, fileOrIdentifier, result);
+
+        switch (scanResult)
+        {
+            case Worker::scanned:
+                returnIdleWorker (worker.release());
+                return true;
+
+            case Worker::unknownFormat:
+                returnIdleWorker (worker.release());
+                format.findAllTypesForFile (result, fileOrIdentifier);
+                return true;
+
+            case Worker::notSent:
+                // if no worker can be started, scanning here is better than not scanning at all
+                if (attempt > 0)
+                {
+                    format.findAllTypesForFile (result, fileOrIdentifier);
+                    return true;
+                }
+                break;
+
+            case Worker::cancelled:
+                // the worker is still busy with the file, so it goes down with it
+                return true;
+
+            default:
+                if (shouldExit())
+                    return true;
+                break;
+        }
+    }
+
+    // the plugin crashed or hung both workers: the list will blacklist it
+    return false;
+}
+
+void OutOfProcessPluginScanner::scanFinished()
+{
+    const ScopedLock sl (lock);
+    idleWorkers.clear();
+}
+
+OutOfProcessPluginScanner::Worker* OutOfProcessPluginScanner::takeIdleWorker()
+{
+    {
+        const ScopedLock sl (lock);
+
+        while (! idleWorkers.isEmpty())
+        {
+            ScopedPointer<Worker> worker (idleWorkers.removeAndReturn (idleWorkers.size() - 1));
+
+            if (worker->isAlive())
+                return worker.release();
+        }
+    }
+
+    return launchWorker();
+}
+
+OutOfProcessPluginScanner::Worker* OutOfProcessPluginScanner::launchWorker()
+{
+    ScopedPointer<Worker> worker (new Worker());
+    return worker->launch() ? worker.release() : nullptr;
+}
+
+void OutOfProcessPluginScanner::returnIdleWorker (Worker* worker)
+{
+    const ScopedLock sl (lock);
+    idleWorkers.add (worker);
+}
+
+//==============================================================================
+const char* const PluginScannerWorker::commandLineUID = "reaktorhost-plugin-scanner";
+
+PluginScannerWorker::PluginScannerWorker()
+    : Thread ("Plugin scan watchdog")
+{
+}
+
+PluginScannerWorker::~PluginScannerWorker()
+{
+    cancelPendingUpdate();
+    stopThread (2000);
+}
+
+void PluginScannerWorker::handleConnectionMade()
+{
+    formatManager.addDefaultFormats();
+    startThread();
+}
+
+void PluginScannerWorker::handleMessageFromMaster (const MemoryBlock& m)
+{
+    // this is the connection's thread, which has to stay free to answer the host's
+    // pings, and some formats can only be scanned on the message thread anyway
+    {
+        const ScopedLock sl (lock);
+        pendingRequest = m;
+    }
+
+    triggerAsyncUpdate();
+}
+
+void PluginScannerWorker::handleConnectionLost()
+{
+    JUCEApplicationBase::quit();
+}
+
+void PluginScannerWorker::handleAsyncUpdate()
+{
+    MemoryBlock request;
+
+    {
+        const ScopedLock sl (lock);
+        request.swapWith (pendingRequest);
+    }
+
+    ScopedPointer<XmlElement> xml (messageToXml (request));
+
+    if (xml == nullptr || ! xml->hasTagName ("SCAN"))
+        return;
+
+    const String formatName (xml->getStringAttribute ("format"));
+    const String fileOrIdentifier (xml->getStringAttribute ("file"));
+
+    XmlElement result ("SCANNED");
+    result.setAttribute ("knownFormat", false);
+
+    for (int i = 0; i < formatManager.getNumFormats(); ++i)
+    {
+        auto* format = formatManager.getFormat (i);
+
+        if (format->getName() == formatName)
+        {
+            OwnedArray<PluginDescription> found;
+
+            scanStartTime = jmax ((uint32) 1, Time::getMillisecondCounter());
+            format->findAllTypesForFile (found, fileOrIdentifier);
+            scanStartTime = 0;
+
+            for (auto* desc : found)
+                result.addChildElement (desc->createXml());
+
+            result.setAttribute ("knownFormat", true);
+            break;
+        }
+    }
+
+    sendMessageToMaster (xmlToMessage (result));
+}
+
+void PluginScannerWorker::run()
+{
+    while (! threadShouldExit())
+    {
+        const uint32 started = scanStartTime.get();
+
+        // a hung plugin has the message thread, so quitting normally would never happen
+        if (started != 0 && Time::getMillisecondCounter() - started > (uint32) OutOfProcessPluginScanner::scanTimeoutMs)
+            Process::terminate();
+
+        wait (500);
+    }
+}
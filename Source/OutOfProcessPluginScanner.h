@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Scans plugin files in child processes instead of inside the host.
+
+    Each file is sent to a worker process (a copy of this executable, started
+    with a special command line), which loads it and sends back the
+    PluginDescriptions it found. The list's scanning threads each use their own
+    worker, so as many files are scanned at once as there are threads, and a
+    plugin that crashes or hangs while being scanned only takes its worker down.
+    The file is tried again with a fresh worker, and only gets blacklisted if it
+    takes that one down too.
+*/
+class OutOfProcessPluginScanner  : public KnownPluginList::CustomScanner
+{
+public:
+    OutOfProcessPluginScanner();
+    ~OutOfProcessPluginScanner();
+
+    /** How many files to scan at once. */
+    static int getNumScanningThreads();
+
+    /** Called from the list's scanning threads. Returns false if the file killed
+        two workers, which makes the list blacklist it. Returns as soon as the scan
+        is cancelled, leaving the worker to be killed.
+    */
+    bool findPluginTypesFor (AudioPluginFormat&, OwnedArray<PluginDescription>&,
+                             const String& fileOrIdentifier) override;
+
+    void scanFinished() override;
+
+    /** A worker is killed if a file takes longer than this to scan. */
+    enum { scanTimeoutMs = 60000 };
+
+private:
+    class Worker;
+
+    CriticalSection lock;
+    OwnedArray<Worker> idleWorkers;
+
+    Worker* takeIdleWorker();
+    static Worker* launchWorker();
+    void returnIdleWorker (Worker*);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OutOfProcessPluginScanner)
+};
+
+//==============================================================================
+/**
+    The child process side of OutOfProcessPluginScanner.
+
+    PluginHostApp::initialise() checks its command line with
+    initialiseFromCommandLine() before doing anything else: if it matches, the
+    app opens no windows and just scans whatever files the host sends, quitting
+    when the host goes away.
+*/
+class PluginScannerWorker  : public ChildProcessSlave,
+                             private AsyncUpdater,
+                             private Thread
+{
+public:
+    PluginScannerWorker();
+    ~PluginScannerWorker();
+
+    static const char* const commandLineUID;
+
+    void handleConnectionMade() override;
+    void handleMessageFromMaster (const MemoryBlock&) override;
+    void handleConnectionLost() override;
+
+private:
+    AudioPluginFormatManager formatManager;
+
+    CriticalSection lock;
+    MemoryBlock pendingRequest;
+    Atomic<uint32> scanStartTime;
+
+    void handleAsyncUpdate() override;
+    void run() override;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginScannerWorker)
+};
@@ -0,0 +1,483 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ParallelGraphRenderer.h"
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+
+//==============================================================================
+/*  The graph's nodes in a form the audio thread can run without looking at the
+    graph: every node has its own buffer, a list of where each of its inputs
+    comes from, and the nodes that are waiting for it.
+
+    The ready queue has one slot per node, since each node becomes ready exactly
+    once per block: pushing takes the next slot, and popping claims the oldest
+    published one with a compare-and-swap.
+*/
+struct ParallelGraphRenderer::Schedule  : public RealtimeWorkerPool::Job
+{
+    enum StepType
+    {
+        plugin,
+        audioInput,
+        audioOutput,
+        midiInput,
+        midiOutput
+    };
+
+    struct AudioSource
+    {
+        int destChannel, sourceStep, sourceChannel;
+    };
+
+    struct Step
+    {
+        AudioProcessorGraph::Node::Ptr node;
+        StepType type = plugin;
+        AudioBuffer<float> buffer;
+        MidiBuffer midi;
+
+        Array<AudioSource> audioSources;
+        Array<int> midiSources, dependents;
+        int numDependencies = 0;
+
+        Atomic<int> numPendingDependencies;
+        Atomic<int> readySlot;
+        NodeLoadStats::Ptr stats;
+    };
+
+    OwnedArray<Step> steps;
+    NodeLoadStats::Ptr graphStats;
+    bool usesGraphRenderer = false;
+    double sampleRate = 0;
+    int blockSize = 0;
+
+    //==============================================================================
+    void render (AudioBuffer<float>& buffer, MidiBuffer& midiMessages, RealtimeWorkerPool& pool) noexcept
+    {
+        const int64 startTicks = Time::getHighResolutionTicks();
+        numSamples = buffer.getNumSamples();
+        budgetTicks = Time::secondsToHighResolutionTicks (numSamples / sampleRate);
+
+        // the inputs are taken before anything can write to the device's buffer
+        for (auto* step : steps)
+        {
+            if (step->type == audioInput)
+            {
+                for (int channel = 0; channel < step->buffer.getNumChannels(); ++channel)
+                {
+                    if (channel < buffer.getNumChannels())
+                        step->buffer.copyFrom (channel, 0, buffer, channel, 0, numSamples);
+                    else
+                        step->buffer.clear (channel, 0, numSamples);
+                }
+            }
+            else if (step->type == midiInput)
+            {
+                step->midi.clear();
+                step->midi.addEvents (midiMessages, 0, numSamples, 0);
+            }
+        }
+
+        buffer.clear();
+        midiMessages.clear();
+        output = &buffer;
+        outputMidi = &midiMessages;
+
+        for (int i = 0; i < steps.size(); ++i)
+        {
+            Step& step = *steps.getUnchecked (i);
+            step.numPendingDependencies = step.numDependencies;
+            step.readySlot = -1;
+        }
+
+        numReadyPushed = 0;
+        numReadyTaken = 0;
+        numStepsFinished = 0;
+        numNodeTicks = 0;
+
+        for (int i = 0; i < steps.size(); ++i)
+            if (steps.getUnchecked (i)->numDependencies == 0)
+                pushReady (i);
+
+        pool.perform (*this, pool.getNumWorkers() + 1);
+
+        lastBlockTicks = Time::getHighResolutionTicks() - startTicks;
+        lastNodeTicks = numNodeTicks.get();
+        graphStats->addBlock (lastBlockTicks, budgetTicks);
+    }
+
+    // every thread that joins in takes ready nodes until the whole graph has been rendered
+    void runTask (int) noexcept override
+    {
+        int next = -1, numIdleSpins = 0;
+
+        while (numStepsFinished.get() < steps.size())
+        {
+            const int index = next >= 0 ? next : popReady();
+            next = -1;
+
+            if (index < 0)
+            {
+                // nothing ready until another thread finishes a node: back off, and
+                // after a while give the core up, in case that thread is waiting for it
+                if (++numIdleSpins < maxPausingSpins)
+                    pause();
+                else
+                    Thread::yield();
+
+                continue;
+            }
+
+            numIdleSpins = 0;
+            renderStep (*steps.getUnchecked (index));
+
+            // carry on with the first node this one releases, and queue the rest
+            for (int dependent : steps.getUnchecked (index)->dependents)
+            {
+                if (--(steps.getUnchecked (dependent)->numPendingDependencies) == 0)
+                {
+                    if (next < 0)
+                        next = dependent;
+                    else
+                        pushReady (dependent);
+                }
+            }
+
+            ++numStepsFinished;
+        }
+    }
+
+    // audio thread: the last block's timings, read after render() returns
+    int64 lastBlockTicks = 0, lastNodeTicks = 0;
+
+private:
+    enum { maxPausingSpins = 64 };
+
+    AudioBuffer<float>* output = nullptr;
+    MidiBuffer* outputMidi = nullptr;
+    int numSamples = 0;
+    int64 budgetTicks = 0;
+
+    Atomic<int> numReadyPushed, numReadyTaken, numStepsFinished;
+    Atomic<int64> numNodeTicks;
+
+    void pushReady (int stepIndex) noexcept
+    {
+        const int slot = (++numReadyPushed) - 1;
+        steps.getUnchecked (slot)->readySlot = stepIndex;
+    }
+
+    int popReady() noexcept
+    {
+        for (;;)
+        {
+            const int slot = numReadyTaken.get();
+
+            if (slot >= numReadyPushed.get())
+                return -1;
+
+            // taken, but not written yet
+            const int stepIndex = steps.getUnchecked (slot)->readySlot.get();
+
+            if (stepIndex < 0)
+                return -1;
+
+            if (numReadyTaken.compareAndSetBool (slot + 1, slot))
+                return stepIndex;
+        }
+    }
+
+    static void pause() noexcept
+    {
+       #if JUCE_INTEL
+        _mm_pause();
+       #endif
+    }
+
+    void gatherInputs (Step& step, AudioBuffer<float>& buffer) noexcept
+    {
+        buffer.clear();
+
+        for (auto& source : step.audioSources)
+            buffer.addFrom (source.destChannel, 0, steps.getUnchecked (source.sourceStep)->buffer,
+                            source.sourceChannel, 0, numSamples);
+
+        step.midi.clear();
+
+        for (int source : step.midiSources)
+            step.midi.addEvents (steps.getUnchecked (source)->midi, 0, numSamples, 0);
+    }
+
+    void renderStep (Step& step) noexcept
+    {
+        if (step.type == audioInput || step.type == midiInput)
+            return;
+
+        // refers to the step's own buffer, cut to this block's length
+        AudioBuffer<float> buffer (step.buffer.getArrayOfWritePointers(), step.buffer.getNumChannels(), numSamples);
+        gatherInputs (step, buffer);
+
+        if (step.type == audioOutput)
+        {
+            for (int channel = 0; channel < jmin (buffer.getNumChannels(), output->getNumChannels()); ++channel)
+                output->addFrom (channel, 0, buffer, channel, 0, numSamples);
+        }
+        else if (step.type == midiOutput)
+        {
+            outputMidi->addEvents (step.midi, 0, numSamples, 0);
+        }
+        else
+        {
+            const int64 startTicks = Time::getHighResolutionTicks();
+            AudioProcessor& processor = *step.node->getProcessor();
+
+            {
+                const RealtimeSanitizer::ScopedExpectedLock<CriticalSection> sl (processor.getCallbackLock());
+
+                if (processor.isSuspended())
+                    buffer.clear();
+                else
+                    processor.processBlock (buffer, step.midi);
+            }
+
+            const int64 ticks = Time::getHighResolutionTicks() - startTicks;
+            step.stats->addBlock (ticks, budgetTicks);
+            numNodeTicks += ticks;
+        }
+    }
+};
+
+//==============================================================================
+ParallelGraphRenderer::ParallelGraphRenderer (FilterGraph& g)
+    : filterGraph (g)
+{
+    workerPool.setPinsWorkersToCores (true);
+    filterGraph.addChangeListener (this);
+}
+
+ParallelGraphRenderer::~ParallelGraphRenderer()
+{
+    filterGraph.removeChangeListener (this);
+}
+
+void ParallelGraphRenderer::setNumThreads (int newNumThreads)
+{
+    newNumThreads = jmax (0, newNumThreads);
+
+    workerPool.setNumWorkers (newNumThreads - 1);
+    numThreads = newNumThreads;
+}
+
+double ParallelGraphRenderer::getParallelSpeedup() const noexcept
+{
+    const int64 blockTicks = totalBlockTicks.get();
+    return blockTicks > 0 ? totalNodeTicks.get() / (double) blockTicks : 1.0;
+}
+
+void ParallelGraphRenderer::resetParallelSpeedup() noexcept
+{
+    totalNodeTicks = 0;
+    totalBlockTicks = 0;
+}
+
+//==============================================================================
+void ParallelGraphRenderer::prepareToPlay (double newSampleRate, int estimatedSamplesPerBlock)
+{
+    AudioProcessorGraph& graph = filterGraph.getGraph();
+
+    graph.setPlayConfigDetails (getTotalNumInputChannels(), getTotalNumOutputChannels(), newSampleRate, estimatedSamplesPerBlock);
+    graph.setProcessingPrecision (getProcessingPrecision());
+    graph.prepareToPlay (newSampleRate, estimatedSamplesPerBlock);
+
+    rebuild();
+}
+
+void ParallelGraphRenderer::releaseResources()
+{
+    schedule.set (nullptr);
+    filterGraph.getGraph().releaseResources();
+}
+
+void ParallelGraphRenderer::reset()
+{
+    filterGraph.getGraph().reset();
+}
+
+void ParallelGraphRenderer::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+{
+    const RealtimeSanitizer::ScopedRealtimeSection realtimeSection;
+    Schedule* s = schedule.acquire();
+
+    if (s != nullptr && ! s->usesGraphRenderer && numThreads.get() > 0
+         && buffer.getNumSamples() <= s->blockSize && s->sampleRate > 0)
+    {
+        s->render (buffer, midiMessages, workerPool);
+
+        totalNodeTicks += s->lastNodeTicks;
+        totalBlockTicks += s->lastBlockTicks;
+    }
+    else
+    {
+        // the graph swaps its own rendering sequence in under this lock
+        AudioProcessorGraph& graph = filterGraph.getGraph();
+        const RealtimeSanitizer::ScopedExpectedLock<CriticalSection> sl (graph.getCallbackLock());
+        graph.processBlock (buffer, midiMessages);
+    }
+
+    schedule.release();
+}
+
+void ParallelGraphRenderer::processBlock (AudioBuffer<double>& buffer, MidiBuffer& midiMessages)
+{
+    const RealtimeSanitizer::ScopedRealtimeSection realtimeSection;
+
+    AudioProcessorGraph& graph = filterGraph.getGraph();
+    const RealtimeSanitizer::ScopedExpectedLock<CriticalSection> sl (graph.getCallbackLock());
+    graph.processBlock (buffer, midiMessages);
+}
+
+//==============================================================================
+void ParallelGraphRenderer::changeListenerCallback (ChangeBroadcaster*)
+{
+    rebuild();
+}
+
+void ParallelGraphRenderer::timerCallback()
+{
+    stopTimer();
+    rebuild();
+}
+
+void ParallelGraphRenderer::rebuild()
+{
+    AudioProcessorGraph& graph = filterGraph.getGraph();
+
+    ScopedPointer<Schedule> s (new Schedule());
+    s->sampleRate = getSampleRate();
+    s->blockSize = getBlockSize();
+    s->graphStats = &profiler.getGraphStats();
+
+    for (int i = 0; i < graph.getNumNodes(); ++i)
+    {
+        AudioProcessorGraph::Node::Ptr node (graph.getNode (i));
+        AudioProcessor* processor = node->getProcessor();
+
+        // the graph prepares new nodes asynchronously, so wait until it has
+        if (processor->getSampleRate() != getSampleRate() || processor->getBlockSize() != getBlockSize())
+        {
+            startTimer (100);
+            s->usesGraphRenderer = true;
+        }
+
+        if (processor->getLatencySamples() > 0)
+            s->usesGraphRenderer = true;
+
+        Schedule::Step* step = s->steps.add (new Schedule::Step());
+        step->node = node;
+
+        if (auto* io = dynamic_cast<AudioProcessorGraph::AudioGraphIOProcessor*> (processor))
+        {
+            switch (io->getType())
+            {
+                case AudioProcessorGraph::AudioGraphIOProcessor::audioInputNode:   step->type = Schedule::audioInput;  break;
+                case AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode:  step->type = Schedule::audioOutput; break;
+                case AudioProcessorGraph::AudioGraphIOProcessor::midiInputNode:    step->type = Schedule::midiInput;   break;
+                case AudioProcessorGraph::AudioGraphIOProcessor::midiOutputNode:   step->type = Schedule::midiOutput;  break;
+                default: break;
+            }
+        }
+        else
+        {
+            step->stats = profiler.getStatsFor (node->nodeId);
+        }
+
+        step->buffer.setSize (jmax (1, processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels()), jmax (1, getBlockSize()));
+        step->midi.ensureSize (2048);
+    }
+
+    auto indexOfNode = [&s] (uint32 nodeId)
+    {
+        for (int i = 0; i < s->steps.size(); ++i)
+            if (s->steps.getUnchecked (i)->node->nodeId == nodeId)
+                return i;
+
+        return -1;
+    };
+
+    for (int i = 0; i < graph.getNumConnections(); ++i)
+    {
+        const AudioProcessorGraph::Connection* c = graph.getConnection (i);
+        const int source = indexOfNode (c->sourceNodeId);
+        const int dest = indexOfNode (c->destNodeId);
+
+        if (source < 0 || dest < 0)
+            continue;
+
+        Schedule::Step& sourceStep = *s->steps.getUnchecked (source);
+        Schedule::Step& destStep = *s->steps.getUnchecked (dest);
+
+        if (c->sourceChannelIndex == AudioProcessorGraph::midiChannelIndex)
+        {
+            destStep.midiSources.addIfNotAlreadyThere (source);
+        }
+        else if (c->sourceChannelIndex < sourceStep.buffer.getNumChannels()
+                  && c->destChannelIndex < destStep.buffer.getNumChannels())
+        {
+            destStep.audioSources.add ({ c->destChannelIndex, source, c->sourceChannelIndex });
+        }
+        else
+        {
+            continue;
+        }
+
+        if (! sourceStep.dependents.contains (dest))
+        {
+            sourceStep.dependents.add (dest);
+            ++destStep.numDependencies;
+        }
+    }
+
+    // the steps that write to the device's buffers run one after the other
+    int previousOutput = -1;
+
+    for (int i = 0; i < s->steps.size(); ++i)
+    {
+        Schedule::Step& step = *s->steps.getUnchecked (i);
+
+        if (step.type == Schedule::audioOutput || step.type == Schedule::midiOutput)
+        {
+            if (previousOutput >= 0)
+            {
+                s->steps.getUnchecked (previousOutput)->dependents.add (i);
+                ++step.numDependencies;
+            }
+
+            previousOutput = i;
+        }
+    }
+
+    schedule.set (s.release());
+}
@@ -0,0 +1,114 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "FilterGraph.h"
+#include "RealtimeWorkerPool.h"
+#include "RealtimeObjectHandoff.h"
+#include "NodeLoadProfiler.h"
+
+
+//==============================================================================
+/**
+    Plays a FilterGraph with its independent branches running at the same time.
+
+    The graph stays the model: nodes and connections are edited on it as before,
+    and it prepares the nodes. Whenever it changes, the renderer works out which
+    node feeds which and hands the audio thread a new schedule. Each block, a
+    node becomes ready once all the nodes feeding it have finished, and the audio
+    thread and the workers take ready nodes until the whole graph is done. A
+    thread that finishes a node carries straight on with one of the nodes it
+    released, and leaves the others for whoever is idle. The output node is
+    joined the same way, on whichever thread finishes its last input.
+
+    Graphs with latency in them, and any block the schedule isn't ready for, are
+    played by the graph's own renderer, which compensates for it. The schedule's
+    buffers are single precision, so double precision processing is left to the
+    graph's renderer too.
+
+    Every node the schedule renders is timed into the profiler, as is each block
+    as a whole; nothing is measured while the graph's own renderer is playing.
+*/
+class ParallelGraphRenderer  : public AudioProcessor,
+                               private ChangeListener,
+                               private Timer
+{
+public:
+    ParallelGraphRenderer (FilterGraph&);
+    ~ParallelGraphRenderer();
+
+    //==============================================================================
+    /** The threads that render the graph, counting the audio thread. 0 leaves it
+        all to the graph's own sequential renderer.
+    */
+    void setNumThreads (int numThreads);
+    int getNumThreads() const noexcept              { return numThreads.get(); }
+
+    /** The time all the nodes took, over the time the blocks took, for every block
+        the schedule has rendered since resetParallelSpeedup().
+    */
+    double getParallelSpeedup() const noexcept;
+    void resetParallelSpeedup() noexcept;
+
+    /** The DSP load of each node, as a share of the time each block lasts. */
+    NodeLoadProfiler& getProfiler() noexcept        { return profiler; }
+
+    //==============================================================================
+    void prepareToPlay (double sampleRate, int estimatedSamplesPerBlock) override;
+    void releaseResources() override;
+    void reset() override;
+    void processBlock (AudioBuffer<float>&, MidiBuffer&) override;
+    void processBlock (AudioBuffer<double>&, MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override     { return true; }
+
+    //==============================================================================
+    const String getName() const override           { return "Parallel graph renderer"; }
+    double getTailLengthSeconds() const override    { return 0; }
+    bool acceptsMidi() const override               { return true; }
+    bool producesMidi() const override              { return true; }
+    bool hasEditor() const override                 { return false; }
+    AudioProcessorEditor* createEditor() override   { return nullptr; }
+    int getNumPrograms() override                   { return 0; }
+    int getCurrentProgram() override                { return 0; }
+    void setCurrentProgram (int) override           {}
+    const String getProgramName (int) override      { return {}; }
+    void changeProgramName (int, const String&) override {}
+    void getStateInformation (MemoryBlock&) override {}
+    void setStateInformation (const void*, int) override {}
+
+private:
+    //==============================================================================
+    struct Schedule;
+
+    FilterGraph& filterGraph;
+    RealtimeObjectHandoff<Schedule> schedule;
+    RealtimeWorkerPool workerPool;
+    NodeLoadProfiler profiler;
+    Atomic<int> numThreads;
+    Atomic<int64> totalNodeTicks, totalBlockTicks;
+
+    void changeListenerCallback (ChangeBroadcaster*) override;
+    void timerCallback() override;
+    void rebuild();
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ParallelGraphRenderer)
+};
@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OscAddressDispatcher.h"
+
+
+//==============================================================================
+/**
+    Builds the OSC address table for every parameter of a plugin instance, and
+    caches the result per plugin and per preset or state chunk loaded into it, so
+    that switching back to a preset doesn't rescan thousands of parameter names.
+
+    One cache is shared by all the processors in the process (use it through a
+    SharedResourcePointer).
+*/
+class ParameterAddressIndex
+{
+public:
+    /** How a parameter name becomes the address that follows "/module/N". */
+    enum MappingRule
+    {
+        /** The name is used untouched, e.g. a Reaktor parameter called "/fader/0". */
+        verbatim = 0,
+
+        /** Like verbatim, but names that don't start with '/' get one, so "Cutoff" is "/Cutoff". */
+        slashPrefixed,
+
+        /** Slash-prefixed and lower-cased, with spaces and OSC pattern characters replaced by '_'. */
+        oscSafe
+    };
+
+    static String mapNameToAddress (const String& name, MappingRule rule)
+    {
+        if (rule == verbatim || name.isEmpty())
+            return name;
+
+        String address (name.startsWithChar ('/') ? name : "/" + name);
+
+        if (rule == oscSafe)
+            address = address.trim().toLowerCase().replaceCharacters (" \t#*,?[]{}", "__________");
+
+        return address;
+    }
+
+    //==============================================================================
+    ParameterAddressIndex() {}
+
+    /** Identifies the contents of a preset or state chunk, for getDispatcherFor().
+        Never returns unknownContents.
+    */
+    static int64 hashChunk (const void* data, size_t size) noexcept
+    {
+        // 64-bit FNV-1a, a word at a time: this runs on every preset switch
+        uint64 hash = 14695981039346656037ULL;
+        const uint8* d = static_cast<const uint8*> (data);
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64 word;
+            memcpy (&word, d + i, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+        }
+
+        for (; i < size; ++i)
+            hash = (hash ^ d[i]) * 1099511628211ULL;
+
+        hash ^= (uint64) size;
+        return hash != unknownContents ? (int64) hash : 1;
+    }
+
+    static int64 hashChunk (const MemoryBlock& data) noexcept   { return hashChunk (data.getData(), data.getSize()); }
+
+    enum { unknownContents = 0 };
+
+    /** Returns the address table for this instance, building it in one pass over the
+        parameters if the cache doesn't already hold one for the same plugin, rule
+        and contents. contentHash is the hashChunk() of the preset or state that was
+        loaded into the instance; an instance whose contents are unknownContents is
+        always scanned, and isn't cached.
+    */
+    OscAddressDispatcher::Ptr getDispatcherFor (AudioPluginInstance& instance, MappingRule rule, int64 contentHash)
+    {
+        const String key (contentHash != unknownContents ? createIdentityKey (instance, rule, contentHash) : String());
+
+        if (key.isNotEmpty())
+        {
+            const ScopedLock sl (lock);
+
+            for (auto* entry : entries)
+            {
+                if (entry->key == key)
+                {
+                    entry->lastUsed = ++useCounter;
+                    ++numHits;
+                    return entry->dispatcher;
+                }
+            }
+        }
+
+        StringArray addresses;
+        const int numParameters = instance.getNumParameters();
+        addresses.ensureStorageAllocated (numParameters);
+
+        for (int i = 0; i < numParameters; ++i)
+            addresses.add (mapNameToAddress (instance.getParameterName (i), rule));
+
+        OscAddressDispatcher::Ptr dispatcher (new OscAddressDispatcher (addresses));
+
+        const ScopedLock sl (lock);
+        ++numMisses;
+
+        if (key.isEmpty())
+            return dispatcher;
+
+        if (entries.size() >= maxNumEntries)
+        {
+            int oldest = 0;
+
+            for (int i = 1; i < entries.size(); ++i)
+                if (entries.getUnchecked (i)->lastUsed < entries.getUnchecked (oldest)->lastUsed)
+                    oldest = i;
+
+            entries.remove (oldest);
+        }
+
+        entries.add (new Entry { key, dispatcher, ++useCounter });
+        return dispatcher;
+    }
+
+    void clear()
+    {
+        const ScopedLock sl (lock);
+        entries.clear();
+    }
+
+    int getNumHits() const noexcept     { return numHits; }
+    int getNumMisses() const noexcept   { return numMisses; }
+
+private:
+    struct Entry
+    {
+        String key;
+        OscAddressDispatcher::Ptr dispatcher;
+        int64 lastUsed;
+    };
+
+    enum { maxNumEntries = 32 };
+
+    CriticalSection lock;
+    OwnedArray<Entry> entries;
+    int64 useCounter = 0;
+    int numHits = 0, numMisses = 0;
+
+    /*  Two ensembles can share an identifier and a parameter count, so the chunk
+        that was loaded tells them apart. None of this asks the plugin for a
+        parameter name, which is what makes a hit cheap.
+    */
+    static String createIdentityKey (AudioPluginInstance& instance, MappingRule rule, int64 contentHash)
+    {
+        PluginDescription pd;
+        instance.fillInPluginDescription (pd);
+
+        return pd.createIdentifierString() + "|" + String ((int) rule) + "|" + String (instance.getNumParameters())
+                 + "|" + String::toHexString (contentHash);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ParameterAddressIndex)
+};
@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Creates a plugin instance for a background thread, without blocking it on
+    the message thread.
+
+    Most formats create their instances on the message thread, and the
+    synchronous createPluginInstance() makes the calling thread wait for that.
+    The threads that use this are stopped from the message thread, which would
+    then be waiting on a thread that's waiting on it. So the instance is asked
+    for asynchronously, and the thread waits in short steps, giving up as soon
+    as it's told to exit. An instance that arrives after that is deleted.
+*/
+class PluginInstanceRequest
+{
+public:
+    /** Returns nullptr if the plugin couldn't be created or the thread was told to exit. */
+    static AudioPluginInstance* create (AudioPluginFormatManager& formatManager, const PluginDescription& desc,
+                                        double sampleRate, int blockSize, Thread& callingThread)
+    {
+        Pending::Ptr pending (new Pending());
+        formatManager.createPluginInstanceAsync (desc, sampleRate, blockSize, new Callback (pending));
+
+        while (! pending->finished.wait (50))
+            if (callingThread.threadShouldExit())
+                return nullptr;
+
+        return pending->instance.release();
+    }
+
+private:
+    // shared by the waiting thread and the callback, so whichever lets go last deletes it
+    struct Pending  : public ReferenceCountedObject
+    {
+        typedef ReferenceCountedObjectPtr<Pending> Ptr;
+
+        ScopedPointer<AudioPluginInstance> instance;
+        WaitableEvent finished;
+    };
+
+    struct Callback  : public AudioPluginFormat::InstantiationCompletionCallback
+    {
+        Callback (Pending* p) : pending (p) {}
+
+        void completionCallback (AudioPluginInstance* newInstance, const String&) override
+        {
+            pending->instance = newInstance;
+            pending->finished.signal();
+        }
+
+        Pending::Ptr pending;
+    };
+};
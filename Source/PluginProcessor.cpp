@@ -21,29 +21,61 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "RealtimeSanitizerHooks.h"
 
 AudioProcessor* JUCE_CALLTYPE createPluginFilter();
 
 
 ReaktorHostProcessor::ReaktorHostProcessor()
 : AudioProcessor (getBusesProperties())
-, wrappedInstance(nullptr)
 , wrappedInstanceEditor (nullptr)
-, isWrappedInstanceReadyToPlay(false)
 , oscPort(1234)
 , instanceNumber(1)
+, addressMappingRule(ParameterAddressIndex::slashPrefixed)
+, wrappedInstanceContentHash(ParameterAddressIndex::unknownContents)
+, parameterChanges(parameterQueueSize)
+, currentSampleRate(44100.0)
+, presetFadeGain(1.0f)
+, presetFadeLengthSamples(441)
+, presetCueTimeMs(0.0)
+, numHeldMidiEvents(0)
+, numHeldMidiBytes(0)
+, presetCrossfadeMs(0)
+, isCrossfadeRunning(false)
+, preloadsPresetFolder(false)
+, compressesState(false)
 {
     formatManager.addDefaultFormats();
+    blockParameterChanges.calloc (parameterQueueSize);
+    presetLoader = new FxpPresetLoader (*this);
+    oscSenderThread = new OscSenderThread (oscRouter);
+    oscInput = new OscInputSocket (*this);
+    presetLoader->getCache().setFolder (File (FXP_FOLDER_PATH));
+    standbyPool = new StandbyInstancePool (formatManager, presetLoader->getCache());
+    moduleRack = new ModuleRack (formatManager, presetLoader->getCache(), getCallbackLock(), *this);
+    pendingNumModules = -1;
 }
 
 ReaktorHostProcessor::~ReaktorHostProcessor()
 {
+    oscInput = nullptr;
+    presetLoader->stop();
+    cancelPendingUpdate();
+    standbyPool = nullptr;
+    moduleRack = nullptr;
+    presetLoader = nullptr;
+    oscSenderThread = nullptr;
 }
 
 
 bool ReaktorHostProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
-    if (wrappedInstance != nullptr)
+    // the modules' own outputs are stereo, or switched off
+    for (int i = 1; i < layouts.outputBuses.size(); ++i)
+        if (! layouts.outputBuses.getReference (i).isDisabled() && layouts.outputBuses.getReference (i) != AudioChannelSet::stereo())
+            return false;
+    
+    if (wrappedInstance.get() != nullptr)
     {
         JUCE_COMPILER_WARNING("should probably check which bus layouts reaktor supports")
 //        return wrappedInstance->isBusesLayoutSupported(layouts);
@@ -73,8 +105,14 @@ bool ReaktorHostProcessor::isBusesLayoutSupported (const BusesLayout& layouts) c
 
 AudioProcessor::BusesProperties ReaktorHostProcessor::getBusesProperties()
 {
-    return BusesProperties().withInput  ("Input",  AudioChannelSet::stereo(), true)
-                            .withOutput ("Output", AudioChannelSet::stereo(), true);
+    BusesProperties properties = BusesProperties().withInput  ("Input",  AudioChannelSet::stereo(), true)
+                                                  .withOutput ("Output", AudioChannelSet::stereo(), true);
+    
+    // one optional output per extra module; while it's disabled, the module is summed into the main output
+    for (int i = 1; i < ModuleRack::maxModules; ++i)
+        properties = properties.withOutput ("Module " + String (i), AudioChannelSet::stereo(), false);
+    
+    return properties;
 }
 
 void ReaktorHostProcessor::addFilterCallback (AudioPluginInstance* instance, const String& error, Point<int> pos)
@@ -88,12 +126,104 @@ void ReaktorHostProcessor::addFilterCallback (AudioPluginInstance* instance, con
         instance->prepareToPlay(getSampleRate(), getBlockSize());
         instance->enableAllBuses();
         
-        wrappedInstance = nullptr;
+        setWrappedInstance (instance, ParameterAddressIndex::unknownContents);
+    }
+}
+
+// the new instance must already be prepared: it's live as soon as it's published.
+// contentHash identifies the preset or state it has, for the address table cache
+void ReaktorHostProcessor::setWrappedInstance (AudioPluginInstance* newInstance, int64 contentHash)
+{
+    // the editor belongs to the old instance, so it has to go first
+    wrappedInstanceEditor = nullptr;
+    
+    // attached before the old instance is retired, so it can still be detached from
+    wrappedInstanceState.attachTo (newInstance);
+    
+    {
+        // the loader thread holds this while it uses the instance
+        const ScopedLock sl (wrappedInstance.getLock());
+        wrappedInstance.set (newInstance);
+        wrappedInstanceContentHash = contentHash;
+    }
+    
+    if (newInstance != nullptr)
+    {
+        wrappedInstanceEditor = newInstance->createEditor();
+        
+        // the standby instances are always of the plugin that's playing
+        PluginDescription pd;
+        newInstance->fillInPluginDescription (pd);
+        standbyPool->setPluginDescription (pd);
+        moduleRack->setPluginDescription (pd);
+    }
+    
+    updateAddressIndex();
+}
+
+void ReaktorHostProcessor::switchToStandby (int slotIndex, double dueTimeMs)
+{
+    presetLoader->switchAsync (slotIndex, dueTimeMs);
+}
+
+void ReaktorHostProcessor::handleAsyncUpdate()
+{
+    if (AudioPluginInstance* outgoing = crossfadeOutgoing.exchange (nullptr))
+    {
+        // the editor belongs to the instance that was faded out, so it goes first
         wrappedInstanceEditor = nullptr;
-        wrappedInstance = instance;
-        wrappedInstanceEditor = instance->createEditor();
-        isWrappedInstanceReadyToPlay = true;
+        
+        {
+            // if another crossfade has started since, the outgoing instance is that
+            // one's, and is still playing
+            const ScopedLock sl (wrappedInstance.getLock());
+            
+            if (outgoingInstance.get() == outgoing)
+                outgoingInstance.set (nullptr);
+        }
+        
+        if (AudioPluginInstance* instance = wrappedInstance.get())
+            wrappedInstanceEditor = instance->createEditor();
     }
+    
+    const int numModules = pendingNumModules.exchange (-1);
+    
+    if (numModules >= 0)
+        setNumModules (numModules);
+}
+
+void ReaktorHostProcessor::setNumModules (int numModules)
+{
+    moduleRack->setNumModules (numModules);
+    
+    // the audio thread takes a share of the modules too, module 0 included
+    workerPool.setNumWorkers (jmin (moduleRack->getNumModules() - 1, SystemStats::getNumCpus() - 1));
+}
+
+// called on the module rack's thread
+void ReaktorHostProcessor::modulePresetLoaded (int moduleIndex, const String& presetName)
+{
+    oscRouter.send (OSCMessage ("/enable", presetName, (int) getInstanceNumber(), moduleIndex));
+}
+
+void ReaktorHostProcessor::setPresetCrossfadeMs (int milliseconds)
+{
+    presetCrossfadeMs = jmax (0, milliseconds);
+}
+
+void ReaktorHostProcessor::setHasCrossfadeSpare (bool shouldHaveSpare)
+{
+    StringArray slots (standbyPool->getSlots());
+    
+    if (shouldHaveSpare == slots.contains (String()))
+        return;
+    
+    if (shouldHaveSpare)
+        slots.add (String());
+    else
+        slots.removeString (String());
+    
+    setStandbySlots (slots);
 }
 
 //==============================================================================
@@ -105,78 +235,405 @@ void ReaktorHostProcessor::prepareToPlay (double newSampleRate, int samplesPerBl
     
 
     
-    if (wrappedInstance != nullptr)
-    {
+    if (wrappedInstance.get() != nullptr)
         wrappedInstance->prepareToPlay(newSampleRate, samplesPerBlock);
-        isWrappedInstanceReadyToPlay = true;
-    }
     
+    currentSampleRate = newSampleRate;
+    currentBlockSize = samplesPerBlock;
+    standbyPool->setPlaybackConfiguration (newSampleRate, samplesPerBlock);
+    crossfader.prepare (jmax (getTotalNumInputChannels(), getTotalNumOutputChannels()), samplesPerBlock);
+    moduleRack->setPlaybackConfiguration (newSampleRate, samplesPerBlock, jmax (getMainBusNumInputChannels(), getMainBusNumOutputChannels()));
     
-    oscOutP5.connect ("127.0.0.1", 9000);
-    oscOutMixer.connect ("127.0.0.1", 10000);
-
+    // 10ms fades around preset changes
+    presetFadeLengthSamples = jmax (1, roundToInt (newSampleRate * 0.01));
+    
+    // room for a block's worth of midi, so splitting a block doesn't allocate
+    subBlockMidi.ensureSize (blockMidiReservedBytes);
+    splitBlockMidiOut.ensureSize (blockMidiReservedBytes);
+    heldMidi.ensureSize (heldMidiReservedBytes);
+    mergedMidi.ensureSize (heldMidiReservedBytes + blockMidiReservedBytes);
+    
+    // the sockets stay open across sample rate and buffer size changes
     int oscPort = getOscPort();
     if (! connect (oscPort))
     {
         //        (ReaktorHostProcessorEditor*)(getWrappedInstanceEditor())->showConnectionErrorMessage ("Error: could not connect to UDP port " + String(oscPort));
     }
     
-    
-    // tell the component to listen for OSC messages matching this address:
-    //    addListener (this); ///load patchnumero1
-    OSCReceiver::addListener(this);
-    
     //OSCOUT
 }
 
 void ReaktorHostProcessor::releaseResources()
 {
-    if (wrappedInstance != nullptr)
+    if (wrappedInstance.get() != nullptr)
         wrappedInstance->releaseResources();
 }
 
 void ReaktorHostProcessor::reset()
 {
-    if (wrappedInstance != nullptr)
+    if (wrappedInstance.get() != nullptr)
         wrappedInstance->reset();
 }
 
+bool ReaktorHostProcessor::queueParameterChange (int parameterIndex, float value)
+{
+    // changes are applied one block late, at the offset they arrived at relative to
+    // the start of the block that was running, so the latency is a constant one buffer
+    const double secondsSinceBlockStart = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - blockStartTicks.get());
+    const int sampleOffset = jlimit (0, jmax (0, currentBlockSize.get() - 1), (int) (secondsSinceBlockStart * currentSampleRate));
+    
+    ParameterChange change = { parameterIndex, value, sampleOffset };
+    return parameterChanges.push (change);
+}
+
+// one task per module, shared between the audio thread and the workers
 template <typename FloatType>
-void ReaktorHostProcessor::process (AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages)
+struct ReaktorHostProcessor::ModuleJob  : public RealtimeWorkerPool::Job
 {
-    if (wrappedInstance != nullptr && isWrappedInstanceReadyToPlay)
+    ModuleJob (ReaktorHostProcessor& p, AudioBuffer<FloatType>& b, MidiBuffer& m, int state, int startSample)
+        : owner (p), buffer (b), midiMessages (m), fadeState (state), fadeStartSample (startSample)
+    {}
+    
+    void runTask (int moduleIndex) noexcept override
     {
-        wrappedInstance->setPlayHead(getPlayHead());
-        wrappedInstance->processBlock(buffer, midiMessages);
+        if (moduleIndex == 0)
+            owner.processMainModule (buffer, midiMessages, fadeState, fadeStartSample);
+        else
+            owner.moduleRack->processModule<FloatType> (moduleIndex, buffer.getNumSamples(), owner.getPlayHead());
     }
     
-     MidiBuffer::Iterator iterator (midiMessages);
-    MidiMessage message;
+    ReaktorHostProcessor& owner;
+    AudioBuffer<FloatType>& buffer;
+    MidiBuffer& midiMessages;
+    const int fadeState, fadeStartSample;
+};
 
-    int sampleNumber;
+template <typename FloatType>
+void ReaktorHostProcessor::process (AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages)
+{
+    const RealtimeSanitizer::ScopedRealtimeSection realtimeSection;
+    const int numSamples = buffer.getNumSamples();
+    blockStartTicks = Time::getHighResolutionTicks();
+    currentBlockSize = numSamples;
+    
+    AudioPlayHead::CurrentPositionInfo position;
+    const bool hasTimeline = getPlayHead() != nullptr && getPlayHead()->getCurrentPosition (position) && position.isPlaying;
+    sampleClock.blockStarted (Time::getMillisecondCounterHiRes(), numSamples, currentSampleRate,
+                              hasTimeline ? position.timeInSamples : 0, hasTimeline);
+    
+    // program changes, MIDI learn and snapshot recall change the state without
+    // telling the listeners
+    if (! midiMessages.isEmpty())
+        wrappedInstanceState.markDirty();
+    
+    int fadeState = presetFadeState.get();
+    int fadeStartSample = 0;
+    
+    if (fadeState == presetFadeOutScheduled)
+    {
+        // start the fade on the cue's sample, once the block it's in comes round
+        const double cueOffset = sampleClock.getSampleOffset (presetCueTimeMs);
+        
+        if (cueOffset < numSamples && presetFadeState.compareAndSetBool (presetFadeOutRequested, presetFadeOutScheduled))
+        {
+            fadeState = presetFadeOutRequested;
+            fadeStartSample = jmax (0, (int) cueOffset);
+        }
+        else
+        {
+            fadeState = presetPlaying;
+        }
+    }
+    
+    // module 0 has the main bus; the other modules' outputs come after it
+    const int numModules = moduleRack->getNumModules();
+    const int numMainChannels = jmin (buffer.getNumChannels(), jmax (getMainBusNumInputChannels(), getMainBusNumOutputChannels()));
+    AudioBuffer<FloatType> mainBuffer (buffer.getArrayOfWritePointers(), numMainChannels, numSamples);
+    
+    // the other modules need the input before module 0 replaces it
+    if (numModules > 1)
+        moduleRack->copyInput (mainBuffer, getMainBusNumInputChannels(), midiMessages);
+    
+    ModuleJob<FloatType> job (*this, mainBuffer, midiMessages, fadeState, fadeStartSample);
+    workerPool.perform (job, numModules);
+    
+    mixModuleOutputs (buffer, mainBuffer, numModules);
+    
+    // read the raw bytes rather than building MidiMessages, and leave the
+    // sending to the OSC sender thread
+    MidiBuffer::Iterator iterator (midiMessages);
+    const uint8* midiData;
+    int numBytes, sampleNumber;
+    
+    while (iterator.getNextEvent (midiData, numBytes, sampleNumber))
+    {
+        if (numBytes >= 3 && (midiData[0] & 0xf0) == 0xb0)
+            oscSenderThread->pushControllerEvent (midiData[1], midiData[2], instanceNumber);
+    }
+    //    midiMessages.clear();
+    
+}
 
-    while (iterator.getNextEvent (message, sampleNumber))
+// renders module 0, the wrapped instance; may run on one of the worker threads
+template <typename FloatType>
+void ReaktorHostProcessor::processMainModule (AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages, int fadeState, int fadeStartSample)
+{
+    if (fadeState == presetSilent)
     {
-        if (message.isController())
+        // the loader thread is applying a preset to the wrapped instance. Its MIDI is
+        // kept for afterwards, so notes playing across the load still get their note-offs
+        buffer.clear();
+        holdMidi (midiMessages);
+    }
+    else if (AudioPluginInstance* instance = wrappedInstance.acquire())
+    {
+        instance->setPlayHead(getPlayHead());
+        
+        if (! heldMidi.isEmpty())
+            releaseHeldMidi (midiMessages);
+        
+        // until the loader has published the incoming instance, both handoffs hold the old one
+        AudioPluginInstance* outgoing = fadeState == presetCrossfading ? outgoingInstance.acquire() : nullptr;
+        
+        if (outgoing != nullptr && outgoing != instance)
         {
-//            std::cout << "midi" << std::endl;
-//            std::cout << message.getControllerNumber() << std::endl;
-//            std::cout << message.getControllerValue() << std::endl;
+            if (! isCrossfadeRunning)
+            {
+                crossfader.start();
+                isCrossfadeRunning = true;
+            }
             
-            oscOutP5.send ("/ctrl", (int) message.getControllerNumber(), (int) message.getControllerValue(), (int) instanceNumber);
+            outgoing->setPlayHead (getPlayHead());
+            crossfader.process (*outgoing, buffer, midiMessages, [&]
+            {
+                processWithParameterChanges (*instance, buffer, midiMessages);
+            });
             
+            if (crossfader.isFinished())
+                presetFadeState.compareAndSetBool (presetCrossfadeDone, presetCrossfading);
+        }
+        else
+        {
+            processWithParameterChanges (*instance, buffer, midiMessages);
+            
+            if (fadeState != presetPlaying)
+                applyPresetFade (buffer, fadeState, fadeStartSample);
         }
     }
-    //    midiMessages.clear();
     
+    if (fadeState != presetCrossfading)
+        isCrossfadeRunning = false;
+    
+    wrappedInstance.release();
+    outgoingInstance.release();
+}
+
+void ReaktorHostProcessor::holdMidi (const MidiBuffer& midiMessages)
+{
+    MidiBuffer::Iterator iterator (midiMessages);
+    const uint8* midiData;
+    int numBytes, sampleNumber;
+    
+    while (iterator.getNextEvent (midiData, numBytes, sampleNumber))
+    {
+        // sysex can be any length, and isn't worth what it would push out
+        if (numBytes <= 0 || midiData[0] == 0xf0)
+            continue;
+        
+        // a MidiBuffer stores each event after a 32-bit time and a 16-bit size
+        const int eventBytes = (int) (sizeof (int32) + sizeof (uint16)) + numBytes;
+        
+        if (numHeldMidiBytes + eventBytes > heldMidiReservedBytes)
+            break;
+        
+        // what stops notes gets the last quarter of the space to itself
+        const bool isNoteOff = numBytes >= 3 && ((midiData[0] & 0xf0) == 0x80 || ((midiData[0] & 0xf0) == 0x90 && midiData[2] == 0));
+        const bool isAllNotesOff = numBytes >= 3 && (midiData[0] & 0xf0) == 0xb0 && midiData[1] >= 120;
+        
+        if (! (isNoteOff || isAllNotesOff)
+             && (numHeldMidiEvents >= maxHeldMidiEvents || numHeldMidiBytes + eventBytes > heldMidiReservedBytes * 3 / 4))
+            continue;
+        
+        heldMidi.addEvent (midiData, numBytes, 0);
+        ++numHeldMidiEvents;
+        numHeldMidiBytes += eventBytes;
+    }
+}
+
+// the held events go at the start of the block, before its own. mergedMidi has room
+// for everything held and a block's worth more
+void ReaktorHostProcessor::releaseHeldMidi (MidiBuffer& midiMessages)
+{
+    mergedMidi.clear();
+    mergedMidi.addEvents (heldMidi, 0, -1, 0);
+    mergedMidi.addEvents (midiMessages, 0, -1, 0);
+    
+    midiMessages.clear();
+    midiMessages.addEvents (mergedMidi, 0, -1, 0);
+    
+    heldMidi.clear();
+    numHeldMidiEvents = 0;
+    numHeldMidiBytes = 0;
+}
+
+template <typename FloatType>
+void ReaktorHostProcessor::mixModuleOutputs (AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& mainBuffer, int numModules)
+{
+    const int numSamples = buffer.getNumSamples();
+    
+    for (int i = 1; i < jmax (numModules, getBusCount (false)); ++i)
+    {
+        const AudioBuffer<FloatType>* output = i < numModules ? moduleRack->getOutput<FloatType> (i) : nullptr;
+        const int numBusChannels = i < getBusCount (false) ? getChannelCountOfBus (false, i) : 0;
+        
+        if (numBusChannels > 0)
+        {
+            // the module's own bus, which is silent if the module isn't playing
+            const int firstChannel = getChannelIndexInProcessBlockBuffer (false, i, 0);
+            
+            for (int channel = 0; channel < numBusChannels; ++channel)
+            {
+                if (output != nullptr && channel < output->getNumChannels())
+                    buffer.copyFrom (firstChannel + channel, 0, *output, channel, 0, numSamples);
+                else
+                    buffer.clear (firstChannel + channel, 0, numSamples);
+            }
+        }
+        else if (output != nullptr)
+        {
+            for (int channel = 0; channel < jmin (mainBuffer.getNumChannels(), output->getNumChannels()); ++channel)
+                mainBuffer.addFrom (channel, 0, *output, channel, 0, numSamples);
+        }
+    }
+}
+
+template <typename FloatType>
+void ReaktorHostProcessor::applyPresetFade (AudioBuffer<FloatType>& buffer, int fadeState, int startSample)
+{
+    const int numSamples = buffer.getNumSamples() - startSample;
+    const float step = numSamples / (float) presetFadeLengthSamples;
+    
+    if (fadeState == presetFadeOutRequested)
+    {
+        const float endGain = jmax (0.0f, presetFadeGain - step);
+        buffer.applyGainRamp (startSample, numSamples, (FloatType) presetFadeGain, (FloatType) endGain);
+        presetFadeGain = endGain;
+        
+        if (endGain <= 0.0f)
+            presetFadeState.compareAndSetBool (presetSilent, presetFadeOutRequested);
+    }
+    else if (fadeState == presetFadingIn)
+    {
+        const float endGain = jmin (1.0f, presetFadeGain + step);
+        buffer.applyGainRamp (0, numSamples, (FloatType) presetFadeGain, (FloatType) endGain);
+        presetFadeGain = endGain;
+        
+        if (endGain >= 1.0f)
+            presetFadeState.compareAndSetBool (presetPlaying, presetFadingIn);
+    }
+}
+
+template <typename FloatType>
+void ReaktorHostProcessor::processWithParameterChanges (AudioPluginInstance& instance, AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages)
+{
+    const int numSamples = buffer.getNumSamples();
+    
+    int numChanges = 0;
+    ParameterChange change;
+    
+    while (numChanges < parameterQueueSize && parameterChanges.pop (change))
+    {
+        // keep the offsets in arrival order and inside this block
+        const int previousOffset = numChanges > 0 ? blockParameterChanges[numChanges - 1].sampleOffset : 0;
+        change.sampleOffset = jlimit (previousOffset, jmax (0, numSamples - 1), change.sampleOffset);
+        blockParameterChanges[numChanges++] = change;
+    }
+    
+    const int numImmediateChanges = numChanges;
+    
+    // the ones that don't fit stay scheduled, and are applied at the start of the next block
+    scheduler.popDueChanges (sampleClock, numSamples, [this, &numChanges] (int parameterIndex, float value, int sampleOffset)
+    {
+        if (numChanges >= parameterQueueSize)
+            return false;
+        
+        blockParameterChanges[numChanges++] = { parameterIndex, value, sampleOffset };
+        return true;
+    });
+    
+    // the scheduled ones can land anywhere in the block, so sort them in; an insertion
+    // sort keeps changes at the same offset in order and doesn't allocate
+    for (int i = numImmediateChanges; i < numChanges; ++i)
+    {
+        const ParameterChange c = blockParameterChanges[i];
+        int j = i;
+        
+        for (; j > 0 && blockParameterChanges[j - 1].sampleOffset > c.sampleOffset; --j)
+            blockParameterChanges[j] = blockParameterChanges[j - 1];
+        
+        blockParameterChanges[j] = c;
+    }
+    
+    if (numChanges == 0)
+    {
+        instance.processBlock (buffer, midiMessages);
+        return;
+    }
+    
+    // these don't go through the instance's listeners, so its state cache doesn't hear about them
+    wrappedInstanceState.markDirty();
+    
+    // split the block at every offset where a parameter changes
+    splitBlockMidiOut.clear();
+    int position = 0, changeIndex = 0;
+    
+    while (position < numSamples)
+    {
+        while (changeIndex < numChanges && blockParameterChanges[changeIndex].sampleOffset <= position)
+        {
+            const ParameterChange& c = blockParameterChanges[changeIndex++];
+            instance.setParameter (c.parameterIndex, c.value);
+        }
+        
+        const int nextPosition = changeIndex < numChanges ? blockParameterChanges[changeIndex].sampleOffset
+                                                          : numSamples;
+        
+        processSubBlock (instance, buffer, midiMessages, position, nextPosition - position);
+        position = nextPosition;
+    }
+    
+    midiMessages.swapWith (splitBlockMidiOut);
+}
+
+template <typename FloatType>
+void ReaktorHostProcessor::processSubBlock (AudioPluginInstance& instance, AudioBuffer<FloatType>& buffer, const MidiBuffer& midiMessages, int startSample, int numSamples)
+{
+    // refers to the host's channel data, so nothing is copied or allocated
+    AudioBuffer<FloatType> subBuffer (buffer.getArrayOfWritePointers(), buffer.getNumChannels(), startSample, numSamples);
+    
+    subBlockMidi.clear();
+    subBlockMidi.addEvents (midiMessages, startSample, numSamples, -startSample);
+    
+    instance.processBlock (subBuffer, subBlockMidi);
+    
+    splitBlockMidiOut.addEvents (subBlockMidi, 0, numSamples, startSample);
 }
 
 //==============================================================================
 AudioProcessorEditor* ReaktorHostProcessor::createEditor()
 {
+    // the wrapped instance's editor is shown inside ours, and what's done in it
+    // doesn't always reach the instance's listeners
+    wrappedInstanceState.setEditorOpen (true);
     return new ReaktorHostProcessorEditor (*this);
 }
 
+void ReaktorHostProcessor::editorBeingDeleted (AudioProcessorEditor* editor) noexcept
+{
+    wrappedInstanceState.setEditorOpen (false);
+    AudioProcessor::editorBeingDeleted (editor);
+}
+
 AudioProcessorEditor* ReaktorHostProcessor::getWrappedInstanceEditor() const
 {
     return wrappedInstanceEditor;
@@ -245,14 +702,33 @@ static void readBusLayoutFromXml (AudioProcessor::BusesLayout& busesLayout, Audi
 
 void ReaktorHostProcessor::getStateInformation (MemoryBlock& destData)
 {
+    const ScopedLock stl (stateLock);
+    PluginStateContainer container;
     XmlElement mainXmlElement ("REAKTOR_HOST_SETTINGS");
     
     mainXmlElement.setAttribute ("uiWidth", lastUIWidth);
     mainXmlElement.setAttribute ("uiHeight", lastUIHeight);
     mainXmlElement.setAttribute ("oscPort", oscPort);
     mainXmlElement.setAttribute ("instanceNumber", instanceNumber);
+    mainXmlElement.setAttribute ("addressMappingRule", (int) addressMappingRule);
+    mainXmlElement.setAttribute ("presetFolder", getPresetFolder().getFullPathName());
+    mainXmlElement.setAttribute ("preloadPresets", preloadsPresetFolder);
+    mainXmlElement.setAttribute ("egressFlushMs", oscRouter.getFlushIntervalMs());
+    mainXmlElement.setAttribute ("egressMaxMessages", oscRouter.getMaxMessagesPerBundle());
+    mainXmlElement.setAttribute ("egressCoalesce", oscRouter.getCoalescesAddresses());
+    mainXmlElement.setAttribute ("oscRelay", getRelaysUnhandledMessages());
+    mainXmlElement.setAttribute ("presetCrossfadeMs", presetCrossfadeMs.get());
+    mainXmlElement.setAttribute ("compressState", compressesState);
+    mainXmlElement.addChildElement (getRoutingTable()->createXml());
+    mainXmlElement.addChildElement (moduleRack->createXml (container));
+    
+    XmlElement* standbyXml = mainXmlElement.createNewChildElement ("STANDBY_POOL");
+    for (auto& presetName : standbyPool->getSlots())
+        standbyXml->createNewChildElement ("SLOT")->setAttribute ("preset", presetName);
     
-    if (wrappedInstance != nullptr){
+    const ScopedLock sl (wrappedInstance.getLock());
+    
+    if (wrappedInstance.get() != nullptr){
         XmlElement* wrappedInstanceXmlElement = new XmlElement ("WRAPPED_INSTANCE");
         
         PluginDescription pd;
@@ -261,9 +737,8 @@ void ReaktorHostProcessor::getStateInformation (MemoryBlock& destData)
         
         XmlElement* state = new XmlElement ("WRAPPED_INSTANCE_STATE");
         
-        MemoryBlock m;
-        wrappedInstance->getStateInformation (m);
-        state->addTextElement (m.toBase64Encoding());
+        const MemoryBlock& m = wrappedInstanceState.getState (*wrappedInstance.get());
+        container.storeChunk (*state, m, wrappedInstanceState.getSnapshotId());
         wrappedInstanceXmlElement->addChildElement (state);
 
         XmlElement* layouts = new XmlElement ("WRAPPED_INSTANCE_LAYOUT");
@@ -277,65 +752,269 @@ void ReaktorHostProcessor::getStateInformation (MemoryBlock& destData)
         
         mainXmlElement.addChildElement(wrappedInstanceXmlElement);
     }
-    copyXmlToBinary (mainXmlElement, destData);
+    
+    container.write (mainXmlElement, destData, compressesState ? PluginStateContainer::zlib : PluginStateContainer::stored,
+                     &lastSavedState);
+}
+
+void ReaktorHostProcessor::loadFxpFile(String fileName, double dueTimeMs)
+{
+    presetLoader->loadAsync (fileName, dueTimeMs);
+}
+
+void ReaktorHostProcessor::setEgressBatching (int flushIntervalMs, int maxMessages, bool coalesceAddresses)
+{
+    oscRouter.setEgressBatching (flushIntervalMs, maxMessages, coalesceAddresses);
+}
+
+void ReaktorHostProcessor::setPresetFolder (const File& folder)
+{
+    presetLoader->getCache().setFolder (folder);
+    
+    if (preloadsPresetFolder)
+        presetLoader->preloadAsync (StringArray());
+}
+
+void ReaktorHostProcessor::setPreloadsPresetFolder (bool shouldPreload)
+{
+    preloadsPresetFolder = shouldPreload;
+    
+    if (shouldPreload)
+        presetLoader->preloadAsync (StringArray());
 }
 
-void ReaktorHostProcessor::loadFxpFile(String fileName)
+void ReaktorHostProcessor::loadPresetIntoWrappedInstance (AudioPluginInstance& instance, const FxpPreset& preset)
 {
-    File f (FXP_FOLDER_PATH + fileName + ".fxp");
-    if (f.exists())
+   #if JUCE_PLUGINHOST_VST
+    VSTPluginFormat::loadFromFXBFile (&instance, preset.data.getData(), preset.data.getSize());
+   //#elif JUCE_PLUGINHOST_AU
+    //AUPluginFormat::loadFromFXBFile (wrappedInstance, mb.getData(), mb.getSize());
+   #endif
+}
+
+// called on the loader thread
+void ReaktorHostProcessor::applyPreset (const FxpPreset& preset, double dueTimeMs)
+{
+    // read once, as the OSC thread can change it meanwhile
+    const int crossfadeMs = presetCrossfadeMs.get();
+    
+    if (wrappedInstance.get() == nullptr)
+        return;
+    
+    if (crossfadeMs > 0 && applyPresetWithCrossfade (preset, dueTimeMs, crossfadeMs))
+        return;
+    
+    // hashed before the audio goes quiet, as it's a pass over the whole preset
+    const int64 contentHash = ParameterAddressIndex::hashChunk (preset.data);
+    
+    // ask the audio thread to fade out, now or on the cue's sample, and wait for it
+    // to stop calling the instance. The instance lock isn't held while waiting, as a
+    // cue can be seconds away and the message thread needs the lock meanwhile
+    double deadlineMs = Time::getMillisecondCounterHiRes();
+    
+    if (dueTimeMs > deadlineMs)
     {
-        MemoryBlock mb;
-        f.loadFileAsData (mb);
-        #if JUCE_PLUGINHOST_VST
-                VSTPluginFormat::loadFromFXBFile (wrappedInstance, mb.getData(), mb.getSize());
-        
-        //Adresses optiomisation
+        presetCueTimeMs = dueTimeMs;
+        presetFadeState = presetFadeOutScheduled;
+        deadlineMs = dueTimeMs;
+    }
+    else
+    {
+        presetFadeState = presetFadeOutRequested;
+    }
+    
+    deadlineMs += 250.0;
+    
+    while (presetFadeState.get() != presetSilent && Time::getMillisecondCounterHiRes() < deadlineMs
+            && ! Thread::currentThreadShouldExit())
+        Thread::sleep (1);
+    
+    {
+        // keeps the instance from being replaced and deleted while the preset goes in
+        const ScopedLock instanceLock (wrappedInstance.getLock());
         
-        addressesMap.clear();
-        std::vector<String>  adressesIncoming;
-        for(int i = 0; i < 8; i++)
+        if (AudioPluginInstance* instance = wrappedInstance.get())
         {
-            adressesIncoming.push_back("/fader/" +  std::to_string(i));
-            adressesIncoming.push_back("/bigButton/" +  std::to_string(i));
-            if(i < 4)
+            wrappedInstanceContentHash = contentHash;
+            
+            if (presetFadeState.get() == presetSilent)
             {
-                adressesIncoming.push_back("/smallButton/" +  std::to_string(i));
+                loadPresetIntoWrappedInstance (*instance, preset);
             }
-        }
-        
-        for(int i = 0; i < wrappedInstance->getNumParameters(); i ++)
-        {
-            for(int j = 0; j < adressesIncoming.size(); j++)
+            else
             {
-                String adr = adressesIncoming[j];
-                if(wrappedInstance->getParameterName(i).compare(adr) == 0)
-                {
-                    addressesMap[adr] = i;
-                    break;
-                }
-                
+                // the audio thread didn't answer, so it isn't running; the callback lock
+                // makes sure it can't start while the state is being set
+                const ScopedLock sl (getCallbackLock());
+                loadPresetIntoWrappedInstance (*instance, preset);
             }
-            //            std::cout << wrappedInstance->getParameterName(i) << std::endl;
-//            if(wrappedInstance->getParameterName(i).compare(name) == 0)
-//            {
-//                wrappedInstance->setParameter (i, value);
-//                break;
-//            }
-//            
         }
+    }
+    
+    wrappedInstanceState.markDirty();
+    presetFadeGain = 0.0f;
+    presetFadeState = presetFadingIn;
+    
+    updateAddressIndex();
+    oscRouter.send (OSCMessage ("/enable", preset.name, (int) getInstanceNumber()));
+}
+
+// called on the loader thread
+bool ReaktorHostProcessor::applyPresetWithCrossfade (const FxpPreset& preset, double dueTimeMs, int crossfadeMs)
+{
+    // a standby instance that already has the preset, or else the spare to load it into
+    OscAddressDispatcher::Ptr dispatcher;
+    ScopedPointer<AudioPluginInstance> incoming (standbyPool->takeInstance (standbyPool->indexOfSlot (preset.name), &dispatcher));
+    
+    if (incoming == nullptr)
+    {
+        incoming = standbyPool->takeInstance (standbyPool->indexOfSlot (String()));
+        
+        if (incoming == nullptr)
+            return false;
+        
+        // it isn't playing, so there's nothing to fade
+        loadPresetIntoWrappedInstance (*incoming, preset);
+    }
+    
+    const int64 contentHash = ParameterAddressIndex::hashChunk (preset.data);
+    
+    if (! crossfadeTo (incoming.release(), contentHash, dispatcher,
+                       roundToInt (currentSampleRate * crossfadeMs / 1000.0), dueTimeMs))
+        return false;
+    
+    oscRouter.send (OSCMessage ("/enable", preset.name, (int) getInstanceNumber()));
+    return true;
+}
+
+// called on the loader thread
+void ReaktorHostProcessor::applyStandbySwitch (int slotIndex, double dueTimeMs)
+{
+    const String presetName (standbyPool->getSlots()[slotIndex]);
+    OscAddressDispatcher::Ptr dispatcher;
+    int64 contentHash = ParameterAddressIndex::unknownContents;
+    
+    if (AudioPluginInstance* instance = standbyPool->takeInstance (slotIndex, &dispatcher, &contentHash))
+    {
+        // never a hard cut: without a crossfade length, it's as short as a preset fade
+        const int crossfadeMs = presetCrossfadeMs.get();
+        const int lengthSamples = crossfadeMs > 0 ? roundToInt (currentSampleRate * crossfadeMs / 1000.0)
+                                                  : presetFadeLengthSamples;
+        
+        if (crossfadeTo (instance, contentHash, dispatcher, lengthSamples, dueTimeMs))
+            oscRouter.send (OSCMessage ("/enable", presetName, (int) getInstanceNumber()));
+    }
+}
+
+// called on the loader thread. Takes ownership of the incoming instance, which must
+// be prepared; dispatcher is its address table if it has one already
+bool ReaktorHostProcessor::crossfadeTo (AudioPluginInstance* newInstance, int64 contentHash,
+                                        OscAddressDispatcher::Ptr dispatcher, int lengthSamples, double dueTimeMs)
+{
+    ScopedPointer<AudioPluginInstance> incoming (newInstance);
+    
+    // no crossfade is running, so the audio thread isn't reading the length
+    crossfader.setLengthSamples (lengthSamples);
+    
+    while (dueTimeMs > Time::getMillisecondCounterHiRes() && ! Thread::currentThreadShouldExit())
+        Thread::sleep (1);
+    
+    OscAddressDispatcher::Ptr oldDispatcher;
+    AudioPluginInstance* outgoing;
+    
+    {
+        // only held for the swap, so the message thread can't replace the instance in between
+        const ScopedLock instanceLock (wrappedInstance.getLock());
+        
+        outgoing = wrappedInstance.get();
+        
+        if (outgoing == nullptr)
+            return false;
+        
+        // the audio thread doesn't start the crossfade while both handoffs hold the
+        // same instance; from the exchange on, the old one is only owned by outgoingInstance
+        outgoingInstance.set (outgoing);
+        presetFadeState = presetCrossfading;
+        
+        AudioPluginInstance* instance = incoming.release();
+        wrappedInstance.exchange (instance);
+        wrappedInstanceContentHash = contentHash;
+        wrappedInstanceState.attachTo (instance);
         
+        // published with the instance, so OSC never reaches it through the old table
+        if (dispatcher != nullptr)
+        {
+            const ScopedLock sl (addressesLock);
+            oldDispatcher = addressDispatcher;
+            addressDispatcher = dispatcher;
+        }
+    }
+    
+    if (dispatcher == nullptr)
+        updateAddressIndex();
+    
+    const double deadlineMs = Time::getMillisecondCounterHiRes() + lengthSamples * 1000.0 / currentSampleRate + 250.0;
+    
+    while (presetFadeState.get() != presetCrossfadeDone && Time::getMillisecondCounterHiRes() < deadlineMs
+            && ! Thread::currentThreadShouldExit())
+        Thread::sleep (1);
+    
+    presetFadeState = presetPlaying;
+    
+    // the editor is swapped on the message thread, which then lets go of this
+    // crossfade's outgoing instance
+    crossfadeOutgoing = outgoing;
+    triggerAsyncUpdate();
+    return true;
+}
+
+void ReaktorHostProcessor::updateAddressIndex()
+{
+    OscAddressDispatcher::Ptr newDispatcher;
+    
+    {
+        const ScopedLock sl (wrappedInstance.getLock());
         
-                //                addressIndexes
-        //#elif JUCE_PLUGINHOST_AU
-                //AUPluginFormat::loadFromFXBFile (wrappedInstance, mb.getData(), mb.getSize());
-        #endif
+        if (wrappedInstance.get() != nullptr)
+            newDispatcher = addressIndex->getDispatcherFor (*wrappedInstance.get(), addressMappingRule, wrappedInstanceContentHash);
+    }
+    
+    // the old table is released outside the lock
+    OscAddressDispatcher::Ptr oldDispatcher;
+    {
+        const ScopedLock sl (addressesLock);
+        oldDispatcher = addressDispatcher;
+        addressDispatcher = newDispatcher;
+    }
+}
+
+void ReaktorHostProcessor::setAddressMappingRule (ParameterAddressIndex::MappingRule rule)
+{
+    if (addressMappingRule != rule)
+    {
+        addressMappingRule = rule;
+        updateAddressIndex();
+        standbyPool->setAddressMappingRule (rule);
+        moduleRack->setAddressMappingRule (rule);
     }
 }
 
 void ReaktorHostProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    ScopedPointer<XmlElement> mainXmlElement (getXmlFromBinary (data, sizeInBytes));
+    // older states are the XML on its own, with the plugin states in it as base64
+    PluginStateContainer container;
+    ScopedPointer<XmlElement> mainXmlElement;
+    
+    if (PluginStateContainer::isContainer (data, (size_t) sizeInBytes))
+    {
+        if (container.read (data, (size_t) sizeInBytes))
+            mainXmlElement = container.createXml();
+    }
+    else
+    {
+        mainXmlElement = getXmlFromBinary (data, sizeInBytes);
+    }
+    
     if (mainXmlElement != nullptr)
     {
         if (mainXmlElement->hasTagName ("REAKTOR_HOST_SETTINGS"))
@@ -344,9 +1023,39 @@ void ReaktorHostProcessor::setStateInformation (const void* data, int sizeInByte
             lastUIHeight    = mainXmlElement->getIntAttribute ("uiHeight", lastUIHeight);
             oscPort         = mainXmlElement->getIntAttribute("oscPort", oscPort);
             instanceNumber  = mainXmlElement->getIntAttribute("instanceNumber", instanceNumber);
+            addressMappingRule = (ParameterAddressIndex::MappingRule) jlimit ((int) ParameterAddressIndex::verbatim, (int) ParameterAddressIndex::oscSafe,
+                                                                              mainXmlElement->getIntAttribute ("addressMappingRule", (int) addressMappingRule));
+            
+            preloadsPresetFolder = mainXmlElement->getBoolAttribute ("preloadPresets", preloadsPresetFolder);
+            compressesState = mainXmlElement->getBoolAttribute ("compressState", compressesState);
+            setEgressBatching (mainXmlElement->getIntAttribute ("egressFlushMs", oscRouter.getFlushIntervalMs()),
+                               mainXmlElement->getIntAttribute ("egressMaxMessages", oscRouter.getMaxMessagesPerBundle()),
+                               mainXmlElement->getBoolAttribute ("egressCoalesce", oscRouter.getCoalescesAddresses()));
+            setPresetFolder (File (mainXmlElement->getStringAttribute ("presetFolder", getPresetFolder().getFullPathName())));
+            setRelaysUnhandledMessages (mainXmlElement->getBoolAttribute ("oscRelay", getRelaysUnhandledMessages()));
+            
+            // older states have no routes, and keep the default P5 and mixer ones
+            if (auto* routes = mainXmlElement->getChildByName ("OSC_ROUTES"))
+                setRoutingTable (OscRoutingTable::fromXml (*routes));
+            
+            if (auto* standbyXml = mainXmlElement->getChildByName ("STANDBY_POOL"))
+            {
+                StringArray presetNames;
+                forEachXmlChildElementWithTagName (*standbyXml, slot, "SLOT")
+                    presetNames.add (slot->getStringAttribute ("preset"));
+                setStandbySlots (presetNames);
+            }
+            
+            setPresetCrossfadeMs (mainXmlElement->getIntAttribute ("presetCrossfadeMs", presetCrossfadeMs.get()));
+            moduleRack->setAddressMappingRule (addressMappingRule);
+            
+            // the other modules are created once the wrapped instance below tells the rack which plugin to use
+            if (auto* modulesXml = mainXmlElement->getChildByName ("MODULES"))
+            {
+                moduleRack->restoreFromXml (*modulesXml, container);
+                setNumModules (moduleRack->getNumModules());
+            }
             
-            oscOutP5.connect ("127.0.0.1", 9000);
-            oscOutMixer.connect ("127.0.0.1", 10000);
             int oscPort = getOscPort();
             if (! connect (oscPort))
             {
@@ -363,33 +1072,38 @@ void ReaktorHostProcessor::setStateInformation (const void* data, int sizeInByte
                     break;
             }
             
+            // the new instance is set up completely before the audio thread sees it,
+            // and the one that's playing carries on until then
             String errorMessage;
-            wrappedInstance = formatManager.createPluginInstance (pd, getSampleRate(), getBlockSize(), errorMessage);
+            ScopedPointer<AudioPluginInstance> newInstance (formatManager.createPluginInstance (pd, getSampleRate(), getBlockSize(), errorMessage));
             
-            if (wrappedInstance == nullptr)
+            if (newInstance == nullptr)
                 return;
             
             if (const XmlElement* const layoutEntity = wrappedInstanceXmlElement->getChildByName ("WRAPPED_INSTANCE_LAYOUT"))
             {
-                AudioProcessor::BusesLayout layout = wrappedInstance->getBusesLayout();
+                AudioProcessor::BusesLayout layout = newInstance->getBusesLayout();
                 
                 const bool isInputChoices[] = { true, false };
                 for (bool isInput : isInputChoices)
-                    readBusLayoutFromXml (layout, wrappedInstance, *layoutEntity, isInput);
+                    readBusLayoutFromXml (layout, newInstance, *layoutEntity, isInput);
                 
-                wrappedInstance->setBusesLayout (layout);
+                newInstance->setBusesLayout (layout);
             }
             
+            int64 contentHash = ParameterAddressIndex::unknownContents;
+            
             if (const XmlElement* const state = wrappedInstanceXmlElement->getChildByName ("WRAPPED_INSTANCE_STATE"))
             {
                 MemoryBlock m;
-                m.fromBase64Encoding (state->getAllSubText());
-                wrappedInstance->setStateInformation (m.getData(), (int) m.getSize());
-                wrappedInstance->prepareToPlay(44100, getBlockSize());
-                wrappedInstanceEditor = wrappedInstance->createEditor();
-                isWrappedInstanceReadyToPlay = true;
-                return;
+                container.readChunk (*state, m);
+                newInstance->setStateInformation (m.getData(), (int) m.getSize());
+                contentHash = ParameterAddressIndex::hashChunk (m);
             }
+            
+            newInstance->prepareToPlay (getSampleRate() > 0 ? getSampleRate() : 44100.0, getBlockSize());
+            setWrappedInstance (newInstance.release(), contentHash);
+            return;
         }
     }
 }
@@ -403,83 +1117,243 @@ AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 }
 
 
-void ReaktorHostProcessor::oscMessageReceived (const OSCMessage& message)
+// called on the OSC input thread with the raw packet
+void ReaktorHostProcessor::oscDatagramReceived (const char* data, int numBytes)
 {
-    std::cout << "got osc" << std::endl;
-    if (message.getAddressPattern().matches("/module/0/load"))
-        if (message.size() == 1 && message[0].isString())
-            loadFxpFile(message[0].getString());
-
+    if (relaysUnhandledMessages.get() != 0 && ! needsLocalHandling (data, numBytes))
+    {
+        oscRouter.relay (data, numBytes);
+        return;
+    }
+    
+    try
+    {
+        OscPacketReader (data, numBytes).readPacket (*this);
+    }
+    catch (OSCFormatError&)
+    {
+        // malformed packets are dropped, as OSCReceiver does
+    }
 }
 
-void ReaktorHostProcessor::oscBundleReceived (const OSCBundle & bundle)
+void ReaktorHostProcessor::oscDatagramsDrained()
 {
-//    std::cout << "got osc" << std::endl;
-    for(int i = 0; i < bundle.size(); i++)
-    {
-        if(bundle.operator[](i).isMessage())
-        {
-            const OSCMessage& message = bundle.operator[](i).getMessage();
-            if (message.getAddressPattern().matches("/module/0/load"))
-            {
-                if (message.size() == 1 && message[0].isString())
-                {
-                    loadFxpFile(message[0].getString());
-                    oscOutP5.send ("/enable", (String) message[0].getString(), (int) getInstanceNumber());
-
-                }
+    oscRouter.flushRelay();
+}
 
+// the N in "/module/N/...", with the length of the "/module/N" part; -1 for other addresses
+static int parseModuleIndex (const char* address, int length, int& prefixLength) noexcept
+{
+    if (length < 10 || memcmp (address, "/module/", 8) != 0)
+        return -1;
+    
+    int i = 8, moduleIndex = 0;
+    
+    while (i < length && i < 11 && address[i] >= '0' && address[i] <= '9')
+        moduleIndex = moduleIndex * 10 + (address[i++] - '0');
+    
+    if (i == 8 || i + 1 >= length || address[i] != '/')
+        return -1;
+    
+    prefixLength = i;
+    return moduleIndex;
+}
 
-            }
-            else if (message.getAddressPattern().matches("/startTimer"))
-            {
-//                if (message.size() == 1 && message[0].isString())
-//                {
-//                    loadFxpFile(message[0].getString());
-//                    oscOutP5.send ("/enable", (String) message[0].getString(), (int) getInstanceNumber());
-//                    
-//                }
-                // send to other instance number 10.10.10.[2-4] port 8000
-                
-                
-            }
-            else if (message.getAddressPattern().toString().substring(0, 10).compare("/module/0/") == 0)
-            {
-//                std::cout << "modules 11111" << std::endl;
-                String parameterName = message.getAddressPattern().toString().substring(9);
-//                std::cout << "modules 11111 " << parameterName <<  std::endl;
-                if(message[0].isFloat32())
-                {
-                    setVstCtrl(parameterName, message[0].getFloat32());
-                }
-                else if(message[0].isInt32())
-                {
-                    setVstCtrl(parameterName, (float)message[0].getInt32());
-                }
+static bool isOscCommand (const char* command, const char* name) noexcept
+{
+    return strcmp (command, name) == 0;
+}
 
-            }
-            else //if (message.getAddressPattern().toString().substring(0, 14).compare("/mixer/module/") == 0)
-            {
-                oscOutMixer.send(message);
-                oscOutP5.send(message);
-//                String addr = message.getAddressPattern().toString();
-//
-//                if(message[0].isFloat32())
-//                {
-//                    oscOutP5.send (addr, (float)message[0].getFloat32());
-//
-//                }
-//                else if(message[0].isInt32())
-//                {
-//                    oscOutP5.send (addr, (int)message[0].getInt32());
-//
-//                }
-            }
-        }
-    }
+// addresses for modules this processor doesn't host are forwarded
+static bool isLocalOscAddress (const char* address, int length, int numModules) noexcept
+{
+    int prefixLength;
+    
+    return isPositiveAndBelow (parseModuleIndex (address, length, prefixLength), numModules)
+        || (length == 11 && memcmp (address, "/startTimer", 11) == 0);
+}
 
+// true if any message in the packet is one handleOscMessage() deals with itself.
+// Malformed packets count as local, so they're parsed and dropped rather than passed on
+bool ReaktorHostProcessor::needsLocalHandling (const char* data, int numBytes) const
+{
+    bool hasLocalAddress = false;
+    const int numModules = moduleRack->getNumModules();
+    
+    const bool isWellFormed = OscPacketReader::visitAddresses (data, numBytes, [&] (const char* address, int length)
+    {
+        hasLocalAddress = isLocalOscAddress (address, length, numModules);
+        return ! hasLocalAddress;
+    });
+    
+    return hasLocalAddress || ! isWellFormed;
+}
 
+// both of these are called on the OSC input thread
+void ReaktorHostProcessor::oscMessageReceived (const OSCMessage& message)
+{
+    handleOscMessage (message, 0.0);
+}
 
+void ReaktorHostProcessor::oscBundleReceived (const OSCBundle & bundle)
+{
+    handleOscBundle (bundle, 0.0);
 }
 
+void ReaktorHostProcessor::handleOscBundle (const OSCBundle& bundle, double dueTimeMs)
+{
+    // a nested bundle can't be due before the one it's in
+    dueTimeMs = jmax (dueTimeMs, SampleClock::timeTagToMillisecondCounter (bundle.getTimeTag()));
+    
+    for(int i = 0; i < bundle.size(); i++)
+    {
+        if(bundle.operator[](i).isMessage())
+            handleOscMessage (bundle.operator[](i).getMessage(), dueTimeMs);
+        else if (bundle.operator[](i).isBundle())
+            handleOscBundle (bundle.operator[](i).getBundle(), dueTimeMs);
+    }
+}
 
+void ReaktorHostProcessor::handleOscMessage (const OSCMessage& message, double dueTimeMs)
+{
+    const String address (message.getAddressPattern().toString());
+    
+    int prefixLength = 0;
+    const int moduleIndex = parseModuleIndex (address.toRawUTF8(), (int) address.getNumBytesAsUTF8(), prefixLength);
+    
+    // module 0's commands are compared straight on the address bytes: matches() would
+    // build an OSCAddress for every comparison
+    const char* command = (moduleIndex == 0 && prefixLength == 9) ? address.toRawUTF8() + prefixLength : "";
+    
+    if (isOscCommand (command, "/load"))
+    {
+        if (message.size() == 1 && message[0].isString())
+            loadFxpFile (message[0].getString(), dueTimeMs);
+    }
+    else if (isOscCommand (command, "/preload"))
+    {
+        // no arguments preloads the whole folder, otherwise each string names a preset
+        StringArray names;
+        for (int i = 0; i < message.size(); ++i)
+            if (message[i].isString())
+                names.add (message[i].getString());
+        
+        presetLoader->preloadAsync (names);
+    }
+    else if (isOscCommand (command, "/cacheStats"))
+    {
+        FxpPresetCache& cache = presetLoader->getCache();
+        oscRouter.send (OSCMessage ("/cacheStats", cache.getNumHits(), cache.getNumMisses(), cache.getNumEntries(),
+                                    (int) (cache.getTotalBytes() / 1024), (int) getInstanceNumber()));
+    }
+    else if (isOscCommand (command, "/standby"))
+    {
+        // the presets to keep ready, one slot each
+        StringArray names;
+        for (int i = 0; i < message.size(); ++i)
+            if (message[i].isString())
+                names.add (message[i].getString());
+        
+        setStandbySlots (names);
+    }
+    else if (isOscCommand (command, "/switch"))
+    {
+        // by slot number or by preset name
+        if (message.size() == 1)
+        {
+            const int slotIndex = message[0].isInt32() ? message[0].getInt32()
+                                : message[0].isString() ? standbyPool->indexOfSlot (message[0].getString()) : -1;
+            
+            if (slotIndex >= 0)
+                switchToStandby (slotIndex, dueTimeMs);
+        }
+    }
+    else if (isOscCommand (command, "/crossfade"))
+    {
+        if (message.size() == 1 && message[0].isInt32())
+            setPresetCrossfadeMs (message[0].getInt32());
+    }
+    else if (isOscCommand (command, "/crossfadeSpare"))
+    {
+        if (message.size() == 1 && message[0].isInt32())
+            setHasCrossfadeSpare (message[0].getInt32() != 0);
+    }
+    else if (isOscCommand (command, "/modules"))
+    {
+        if (message.size() == 1 && message[0].isInt32())
+        {
+            pendingNumModules = jmax (0, message[0].getInt32());
+            triggerAsyncUpdate();
+        }
+    }
+    else if (isOscCommand (command, "/egress"))
+    {
+        // flush interval in ms (0 turns batching off), then optionally the bundle size and coalescing
+        if (message.size() >= 1 && message[0].isInt32())
+            setEgressBatching (message[0].getInt32(),
+                               message.size() >= 2 && message[1].isInt32() ? message[1].getInt32() : oscRouter.getMaxMessagesPerBundle(),
+                               message.size() >= 3 && message[2].isInt32() ? message[2].getInt32() != 0 : oscRouter.getCoalescesAddresses());
+    }
+    else if (isOscCommand (command, "/compressState"))
+    {
+        if (message.size() == 1 && message[0].isInt32())
+            setCompressesState (message[0].getInt32() != 0);
+    }
+    else if (isOscCommand (command, "/poolStats"))
+    {
+        // one reply per slot: index, preset, ready, KB, CPU load in percent
+        const Array<StandbyInstancePool::SlotInfo> slots (standbyPool->getSlotInfo());
+        
+        for (int i = 0; i < slots.size(); ++i)
+        {
+            const StandbyInstancePool::SlotInfo& slot = slots.getReference (i);
+            oscRouter.send (OSCMessage ("/poolStats", i, slot.presetName, (int) slot.isReady, (int) (slot.memoryBytes / 1024),
+                                        (float) (slot.cpuLoad * 100.0), (int) getInstanceNumber()));
+        }
+    }
+    else if (strcmp (address.toRawUTF8(), "/startTimer") == 0)
+    {
+        // send to other instance number 10.10.10.[2-4] port 8000
+    }
+    else if (moduleIndex > 0 && moduleIndex < moduleRack->getNumModules())
+    {
+        // the other modules take presets and parameters, and everything else is module 0's
+        const char* name = address.toRawUTF8() + prefixLength;
+        const size_t numBytes = address.getNumBytesAsUTF8() - (size_t) prefixLength;
+        
+        if (strcmp (name, "/load") == 0)
+        {
+            if (message.size() == 1 && message[0].isString())
+                moduleRack->loadPreset (moduleIndex, message[0].getString());
+        }
+        else if (! message.isEmpty())
+        {
+            if (message[0].isFloat32())
+                moduleRack->setParameter (moduleIndex, name, numBytes, message[0].getFloat32());
+            else if (message[0].isInt32())
+                moduleRack->setParameter (moduleIndex, name, numBytes, (float) message[0].getInt32());
+        }
+    }
+    else if (address.startsWith ("/module/0/"))
+    {
+        if (message.isEmpty())
+            return;
+        
+        // look the parameter up straight from the address bytes, skipping "/module/0"
+        const char* parameterName = address.toRawUTF8() + 9;
+        const size_t numBytes = address.getNumBytesAsUTF8() - 9;
+        
+        if(message[0].isFloat32())
+        {
+            setVstCtrl(parameterName, numBytes, message[0].getFloat32(), dueTimeMs);
+        }
+        else if(message[0].isInt32())
+        {
+            setVstCtrl(parameterName, numBytes, (float)message[0].getInt32(), dueTimeMs);
+        }
+    }
+    else //if (message.getAddressPattern().toString().substring(0, 14).compare("/mixer/module/") == 0)
+    {
+        oscRouter.send (message);
+    }
+}
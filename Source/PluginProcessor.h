@@ -22,22 +22,51 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
-#include <map>
-#include  <vector>
+#include "RealtimeFifo.h"
+#include "ParameterAddressIndex.h"
+#include "FxpPresetLoader.h"
+#include "OscSenderThread.h"
+#include "OscInputSocket.h"
+#include "OscPacketReader.h"
+#include "OscRouter.h"
+#include "OscScheduler.h"
+#include "RealtimeObjectHandoff.h"
+#include "StandbyInstancePool.h"
+#include "InstanceCrossfader.h"
+#include "ModuleRack.h"
+#include "RealtimeWorkerPool.h"
+#include "PluginStateContainer.h"
+#include "PluginStateCache.h"
 
 static String FXP_FOLDER_PATH = "/Users/lucas/Work/MOI/17_01_antiVolume/08_jucePatches/";
 
+/** A parameter change received over OSC, waiting to be applied by the audio thread. */
+struct ParameterChange
+{
+    int parameterIndex;
+    float value;
+    int sampleOffset;
+};
+
 class ReaktorHostProcessor  : public AudioProcessor
-                            , public OSCReceiver
-                            , public OSCReceiver::Listener<OSCReceiver::MessageLoopCallback>
+                            , private OscInputSocket::Listener
+                            , private FxpPresetLoader::Target
+                            , private AsyncUpdater
+                            , private ModuleRack::Listener
 {
 public:
     //==============================================================================
     ReaktorHostProcessor();
     ~ReaktorHostProcessor();
     
-    void oscMessageReceived (const OSCMessage& message) override;
-    void oscBundleReceived (const OSCBundle & bundle) override;
+    /** Starts listening for OSC on a UDP port. */
+    bool connect (int portNumber)           { return oscInput->connect (portNumber); }
+    bool disconnect()                       { return oscInput->disconnect(); }
+    
+    // called on the OSC input thread for packets that are handled here. Bundles
+    // with a time tag in the future are applied at that time, to the sample
+    void oscMessageReceived (const OSCMessage& message);
+    void oscBundleReceived (const OSCBundle & bundle);
 
 
     //==============================================================================
@@ -46,38 +75,105 @@ public:
     void releaseResources() override;
     void reset() override;
     
-    void loadFxpFile(String fileName);
+    /** Loads fileName.fxp from the preset folder in the background (or from memory if
+        it's cached). The audio fades out, the preset is applied while the wrapped
+        instance isn't processing, and the audio fades back in. Returns immediately.
+     
+        If dueTimeMs (in Time::getMillisecondCounterHiRes() terms) is in the future,
+        the preset is made ready straight away but the fade starts on the sample
+        that falls at that time.
+    */
+    void loadFxpFile(String fileName, double dueTimeMs = 0.0);
+    
+    File getPresetFolder() const                { return presetLoader->getCache().getFolder(); }
+    void setPresetFolder (const File& folder);
+    
+    /** When enabled, every preset in the folder is read into memory up front. */
+    bool getPreloadsPresetFolder() const        { return preloadsPresetFolder; }
+    void setPreloadsPresetFolder (bool shouldPreload);
+    
+    FxpPresetCache& getPresetCache()            { return presetLoader->getCache(); }
+    
+    /** Instances of the current plugin kept ready in the background, one per
+        preset name, so that switchToStandby() doesn't wait for instantiation.
+    */
+    StandbyInstancePool& getStandbyPool()       { return *standbyPool; }
+    void setStandbySlots (const StringArray& presetNames)   { standbyPool->setSlots (presetNames); }
+    
+    /** Crossfades to a standby instance, now or at dueTimeMs, on the preset loader's
+        thread. Returns straight away; if the slot isn't ready by then, nothing happens.
+    */
+    void switchToStandby (int slotIndex, double dueTimeMs = 0.0);
+    
+    /** With a crossfade length, a preset goes into a second instance (a standby one
+        that already has it, or the spare) which is crossfaded with the playing one,
+        instead of fading out and in. 0 turns it off. Presets with neither still
+        fade out and in.
+    */
+    int getPresetCrossfadeMs() const            { return presetCrossfadeMs.get(); }
+    void setPresetCrossfadeMs (int milliseconds);
+    
+    /** The spare is a standby slot with no preset, i.e. a whole extra instance of
+        the plugin kept ready, which any preset can be crossfaded into.
+    */
+    bool hasCrossfadeSpare() const              { return standbyPool->indexOfSlot (String()) >= 0; }
+    void setHasCrossfadeSpare (bool shouldHaveSpare);
+    
+    /** How many copies of the wrapped plugin this processor hosts, answering to
+        /module/0/ up to /module/N-1/. Module 0 is the wrapped instance; the others
+        are created in the background as instances of the same plugin.
+     
+        All the modules run on the same input, spread over a pool of realtime
+        worker threads. A module whose output bus ("Module N") the host has enabled
+        plays there, and the rest are summed into the main output.
+    */
+    int getNumModules() const                   { return moduleRack->getNumModules(); }
+    
+    /** Call on the message thread: the rack's instances and worker threads are started here. */
+    void setNumModules (int numModules);
+    
+    /** Rebuilds (or fetches from the cache) the table mapping OSC addresses to
+        the wrapped instance's parameters. Don't call this on the audio thread.
+    */
+    void updateAddressIndex();
     
+    ParameterAddressIndex::MappingRule getAddressMappingRule() const    { return addressMappingRule; }
+    void setAddressMappingRule (ParameterAddressIndex::MappingRule rule);
     
-    std::map<String,int> addressesMap;
     
-    void setVstCtrl(String name, float value)
+    // called from the OSC thread: the change is queued and applied by process().
+    // name is the raw UTF-8 address with the /module/0 prefix stripped, and isn't copied
+    void setVstCtrl(const char* name, size_t numBytes, float value, double dueTimeMs = 0.0)
     {
-        //optimize: when loading fxp look for /fader/[0-9] and write into table for direct access
     #if JUCE_PLUGINHOST_VST
-//        for(int i = 0; i < wrappedInstance->getNumParameters(); i ++)
-//        {
-////            std::cout << wrappedInstance->getParameterName(i) << std::endl;
-//            if(wrappedInstance->getParameterName(i).compare(name) == 0)
-//            {
-//                wrappedInstance->setParameter (i, value);
-//                break;
-//            }
-//
-//        }
-        auto it = addressesMap.find(name);
-        if (it != addressesMap.end())
+        int index = -1;
         {
-            int index = it->second;
-            wrappedInstance->setParameter (index, value);
-
+            const ScopedLock sl (addressesLock);
+            if (addressDispatcher != nullptr)
+                index = addressDispatcher->find (name, numBytes);
         }
         
+        if (index < 0)
+            return;
         
+        if (dueTimeMs > Time::getMillisecondCounterHiRes())
+            scheduler.schedule (index, value, dueTimeMs);
+        else
+            queueParameterChange (index, value);
     #endif
-
     }
     
+    void setVstCtrl(const String& name, float value)
+    {
+        setVstCtrl (name.toRawUTF8(), name.getNumBytesAsUTF8(), value);
+    }
+    
+    /** Queues a parameter change for the audio thread, stamped with the sample
+        position in the current block at which it arrived. Safe to call from the
+        OSC thread. Returns false if the queue is full and the change was dropped.
+    */
+    bool queueParameterChange (int parameterIndex, float value);
+    
 
     //==============================================================================
     void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
@@ -93,6 +189,7 @@ public:
     //==============================================================================
     bool hasEditor() const override                                             { return true; }
     AudioProcessorEditor* createEditor() override;
+    void editorBeingDeleted (AudioProcessorEditor*) noexcept override;
     AudioProcessorEditor* getWrappedInstanceEditor() const;
 
     //==============================================================================
@@ -115,32 +212,180 @@ public:
     
     int getInstanceNumber()             {return instanceNumber;}
     void setInstanceNumber(int number)  {instanceNumber = number;}
+    
+    /** Forwarded messages are batched into a bundle per destination, flushed every
+        flushIntervalMs (0 sends them straight away) or once maxMessages are queued.
+        With coalescing, only the latest message per address is sent in each bundle.
+        Off by default; also set by /module/0/egress.
+    */
+    void setEgressBatching (int flushIntervalMs, int maxMessages, bool coalesceAddresses);
+    
+    /** In relay mode, packets with no address this instance handles are forwarded to
+        their routes' destinations byte for byte, without being parsed or re-encoded.
+        Bundles that mix local and forwarded messages still go through the egress batchers.
+    */
+    bool getRelaysUnhandledMessages() const                 { return relaysUnhandledMessages.get() != 0; }
+    void setRelaysUnhandledMessages (bool shouldRelay)      { relaysUnhandledMessages = shouldRelay ? 1 : 0; }
+    
+    /** Where everything this instance sends goes, forwarded messages and its own replies alike. */
+    OscRoutingTable::Ptr getRoutingTable() const                { return oscRouter.getRoutingTable(); }
+    void setRoutingTable (OscRoutingTable::Ptr newTable)        { oscRouter.setRoutingTable (newTable); }
 
     //==============================================================================
+    /** The state is a PluginStateContainer, with the plugin states stored as binary
+        chunks. States saved as XML before it came in are still read.
+        
+        The plugins are only asked for their states again once something may have
+        changed, and if nothing has, the last state is given again.
+    */
     void getStateInformation (MemoryBlock&) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
+    
+    /** zlib-compresses the plugin states when saving: smaller sessions, slower saves. */
+    bool getCompressesState() const                 { return compressesState; }
+    void setCompressesState (bool shouldCompress)   { compressesState = shouldCompress; }
 
     // these are used to persist the UI's size
     int lastUIWidth = 400, lastUIHeight = 200;
     
     void addFilterCallback (AudioPluginInstance* instance, const String& error, Point<int> pos);
 
-    OSCSender oscOutP5;
-    OSCSender oscOutMixer;
-
 
 private:
     //==============================================================================
     template <typename FloatType>
     void process (AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages);
+    template <typename FloatType>
+    void processMainModule (AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages, int fadeState, int fadeStartSample);
+    void holdMidi (const MidiBuffer& midiMessages);
+    void releaseHeldMidi (MidiBuffer& midiMessages);
+    template <typename FloatType>
+    void mixModuleOutputs (AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& mainBuffer, int numModules);
+    template <typename FloatType>
+    struct ModuleJob;
+    template <typename FloatType>
+    void processWithParameterChanges (AudioPluginInstance& instance, AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages);
+    template <typename FloatType>
+    void processSubBlock (AudioPluginInstance& instance, AudioBuffer<FloatType>& buffer, const MidiBuffer& midiMessages, int startSample, int numSamples);
     static BusesProperties getBusesProperties();
     
-    ScopedPointer<AudioPluginInstance> wrappedInstance;
+    template <typename FloatType>
+    void applyPresetFade (AudioBuffer<FloatType>& buffer, int fadeState, int startSample);
+    
+    void handleOscMessage (const OSCMessage& message, double dueTimeMs);
+    void handleOscBundle (const OSCBundle& bundle, double dueTimeMs);
+    void oscDatagramReceived (const char* data, int numBytes) override;
+    void oscDatagramsDrained() override;
+    bool needsLocalHandling (const char* data, int numBytes) const;
+    void applyPreset (const FxpPreset&, double dueTimeMs) override;
+    bool applyPresetWithCrossfade (const FxpPreset&, double dueTimeMs, int crossfadeMs);
+    void applyStandbySwitch (int slotIndex, double dueTimeMs) override;
+    bool crossfadeTo (AudioPluginInstance* newInstance, int64 contentHash,
+                      OscAddressDispatcher::Ptr dispatcher, int lengthSamples, double dueTimeMs);
+    void loadPresetIntoWrappedInstance (AudioPluginInstance&, const FxpPreset&);
+    void setWrappedInstance (AudioPluginInstance* newInstance, int64 contentHash);
+    void handleAsyncUpdate() override;
+    void modulePresetLoaded (int moduleIndex, const String& presetName) override;
+    
+    // the audio thread picks up a new instance at the start of its next block, and
+    // the old one is deleted once it has let go; other threads hold getLock()
+    RealtimeObjectHandoff<AudioPluginInstance, PluginInstanceDeletePolicy> wrappedInstance;
+    
+    // declared after wrappedInstance, so it's deleted while the instance still exists
+    PluginStateCache wrappedInstanceState;
+    
+    // held while the state is saved, as the host may ask for it on more than one thread
+    CriticalSection stateLock;
+    PluginStateContainer::WriteCache lastSavedState;
+    
+    // the instance being faded out during a crossfade; it's let go of on the message thread
+    RealtimeObjectHandoff<AudioPluginInstance, PluginInstanceDeletePolicy> outgoingInstance;
     ScopedPointer<AudioProcessorEditor> wrappedInstanceEditor;
     AudioPluginFormatManager formatManager;
     
-    bool isWrappedInstanceReadyToPlay;
     int oscPort, instanceNumber;
+    
+    // maps incoming addresses to parameter indexes; rebuilt on the message thread
+    // when a preset is loaded and read on the OSC thread, under addressesLock
+    CriticalSection addressesLock;
+    OscAddressDispatcher::Ptr addressDispatcher;
+    SharedResourcePointer<ParameterAddressIndex> addressIndex;
+    ParameterAddressIndex::MappingRule addressMappingRule;
+    
+    // the hashChunk() of the preset or state the wrapped instance was last given,
+    // which the address table is cached by; under the instance lock
+    int64 wrappedInstanceContentHash;
+    
+    // presets are read on the loader thread, then applied once the audio thread has
+    // faded out and stopped calling the wrapped instance
+    enum PresetFadeState
+    {
+        presetPlaying = 0,
+        presetFadeOutScheduled,
+        presetFadeOutRequested,
+        presetSilent,
+        presetFadingIn,
+        presetCrossfading,
+        presetCrossfadeDone
+    };
+    
+    ScopedPointer<FxpPresetLoader> presetLoader;
+    bool preloadsPresetFolder;
+    bool compressesState;
+    
+    // switches are crossfades, made on the loader thread like crossfaded presets
+    ScopedPointer<StandbyInstancePool> standbyPool;
+    
+    InstanceCrossfader crossfader;
+    Atomic<int> presetCrossfadeMs;           // set on the OSC thread, read on the loader thread
+    bool isCrossfadeRunning;                 // audio thread only
+    Atomic<AudioPluginInstance*> crossfadeOutgoing;
+    
+    // the modules after module 0, and the threads that render them alongside it
+    ScopedPointer<ModuleRack> moduleRack;
+    RealtimeWorkerPool workerPool;
+    
+    // a count asked for over OSC, applied on the message thread as that starts threads
+    Atomic<int> pendingNumModules;
+    
+    // all outgoing OSC, sent as a bundle per destination
+    OscRouter oscRouter;
+    
+    // turns the audio thread's outgoing events into OSC, and flushes the batchers
+    ScopedPointer<OscSenderThread> oscSenderThread;
+    
+    // incoming OSC, and the pass-through for packets that aren't for this instance
+    ScopedPointer<OscInputSocket> oscInput;
+    Atomic<int> relaysUnhandledMessages;
+    Atomic<int> presetFadeState;
+    float presetFadeGain;
+    int presetFadeLengthSamples;
+    
+    // when a scheduled fade starts; written before presetFadeState is set to
+    // presetFadeOutScheduled, and only read by the audio thread after that
+    double presetCueTimeMs;
+    
+    // OSC thread -> audio thread parameter changes
+    enum { parameterQueueSize = 1024 };
+    RealtimeFifo<ParameterChange> parameterChanges;
+    HeapBlock<ParameterChange> blockParameterChanges;
+    MidiBuffer subBlockMidi, splitBlockMidiOut;
+    
+    // MIDI that arrived while a preset was being applied, delivered once it's done.
+    // Nothing is held past the space reserved for it, so the audio thread never allocates
+    enum { maxHeldMidiEvents = 256, heldMidiReservedBytes = 4096, blockMidiReservedBytes = 2048 };
+    MidiBuffer heldMidi, mergedMidi;
+    int numHeldMidiEvents, numHeldMidiBytes;
+    
+    // written by the audio thread at the top of each block, read by the OSC thread
+    // to work out where in the block a change arrived
+    Atomic<int64> blockStartTicks;
+    Atomic<int> currentBlockSize;
+    double currentSampleRate;
+    
+    // future-dated changes from time-tagged bundles, placed using the audio thread's clock
+    SampleClock sampleClock;
+    OscScheduler scheduler;
 
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReaktorHostProcessor)
@@ -0,0 +1,143 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    The state a plugin instance last gave, so it's only asked for it again once
+    something may have changed.
+
+    Getting the state of a big ensemble can take hundreds of milliseconds, and a
+    host asks for it on every autosave. The cache is marked dirty when the instance
+    tells its listeners that a parameter or anything else has changed, and by the
+    code that sets parameters, loads presets or sends the instance MIDI behind the
+    listeners' backs. Plenty
+    of plugins change their state from their own editor without telling anyone,
+    so while the editor is open, or once it has been since the last time, the
+    state is always asked for.
+
+    A state that comes back the same as the last one keeps its snapshot id, so
+    PluginStateContainer::write() can tell nothing has changed.
+*/
+class PluginStateCache  : private AudioProcessorListener
+{
+public:
+    PluginStateCache() {}
+
+    ~PluginStateCache()
+    {
+        // the instance it's attached to has to outlive it
+        if (instance != nullptr)
+            instance->removeListener (this);
+    }
+
+    //==============================================================================
+    /** Call whenever the instance is replaced, while the old one still exists: the
+        cache stops listening to it before listening to the new one.
+    */
+    void attachTo (AudioPluginInstance* newInstance)
+    {
+        const ScopedLock sl (lock);
+
+        if (instance != nullptr)
+            instance->removeListener (this);
+
+        instance = newInstance;
+
+        if (newInstance != nullptr)
+            newInstance->addListener (this);
+
+        markDirty();
+    }
+
+    /** Any thread, including the audio thread. */
+    void markDirty() noexcept                   { dirty = 1; }
+
+    /** Closing the editor marks the cache dirty, for the changes made up to then. */
+    void setEditorOpen (bool isOpen) noexcept
+    {
+        editorOpen = isOpen ? 1 : 0;
+        markDirty();
+    }
+
+    /** Call holding the lock that keeps the instance alive. The result stays valid
+        until the next call.
+    */
+    const MemoryBlock& getState (AudioPluginInstance& currentInstance)
+    {
+        const ScopedLock sl (lock);
+
+        // the instance should have been attached when it was set, by which time the
+        // one attached to may have gone, so it's left alone here
+        if (&currentInstance != instance)
+        {
+            instance = &currentInstance;
+            currentInstance.addListener (this);
+            markDirty();
+        }
+
+        // cleared first, so a change made while the state is being read isn't lost
+        const bool mayHaveChanged = dirty.exchange (0) != 0 || editorOpen.get() != 0
+                                      || currentInstance.getActiveEditor() != nullptr;
+
+        if (mayHaveChanged || snapshotId == 0)
+        {
+            MemoryBlock newState;
+            currentInstance.getStateInformation (newState);
+
+            if (snapshotId == 0 || newState != state)
+            {
+                state.swapWith (newState);
+                snapshotId = createSnapshotId();
+            }
+        }
+
+        return state;
+    }
+
+    /** Identifies what getState() last returned. */
+    int64 getSnapshotId() const noexcept        { return snapshotId; }
+
+private:
+    //==============================================================================
+    CriticalSection lock;
+    AudioPluginInstance* instance = nullptr;
+    Atomic<int> dirty, editorOpen;
+
+    MemoryBlock state;
+    int64 snapshotId = 0;
+
+    // unique across all the caches, as the instances can be swapped between them
+    static int64 createSnapshotId() noexcept
+    {
+        static Atomic<int64> lastId;
+        return ++lastId;
+    }
+
+    void audioProcessorParameterChanged (AudioProcessor*, int, float) override  { markDirty(); }
+    void audioProcessorChanged (AudioProcessor*) override                       { markDirty(); }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginStateCache)
+};
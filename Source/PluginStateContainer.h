@@ -0,0 +1,464 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    The processor's saved state, and the host's binary .filtergraph documents: a
+    short header, the settings as XML, and the plugin states stored as they are
+    instead of as base64 text inside the XML.
+
+    All numbers are little-endian:
+
+        "RHST"      magic
+        uint16      format version
+        uint16      number of chunks
+        then for each chunk:
+            uint8   flags (1 = zlib-compressed, 2 = delta)
+            uint64  stored size
+            uint64  original size
+            bytes   the stored data
+
+    Chunk 0 is the settings XML, as UTF-8 text. An XML element that has a plugin
+    state refers to its chunk by index, in a "chunk" attribute.
+
+    A big chunk that's mostly the same as an earlier one (modules running the
+    same ensemble, say) is stored as a delta against it: a uint16 base chunk
+    index, then until the chunk is complete, a uint32 length and that many new
+    bytes, followed by a uint32 offset and uint32 length to copy from the base.
+    A delta is compressed after it's made, if the chunk is compressed.
+
+    Reading doesn't copy anything until a chunk is asked for, so the data passed
+    to read() has to stay valid while the container is used.
+*/
+class PluginStateContainer
+{
+public:
+    enum { currentVersion = 2 };
+
+    enum Compression
+    {
+        stored = 0,
+        zlib   = 1
+    };
+
+    /** What write() wrote last time. If the XML and every chunk's snapshot id are
+        the same, that's given back again instead of writing it all out.
+    */
+    struct WriteCache
+    {
+        String xmlText;
+        Array<int64> snapshotIds;
+        Compression compression = stored;
+        MemoryBlock data;
+    };
+
+    PluginStateContainer() {}
+
+    //==============================================================================
+    /** Adds a chunk to be written, and returns its index. */
+    int addChunk (MemoryBlock&& data)
+    {
+        const MemoryBlock* block = ownedChunks.add (new MemoryBlock (static_cast<MemoryBlock&&> (data)));
+        const ChunkToWrite chunk = { block, 0 };
+        chunksToWrite.add (chunk);
+        return chunksToWrite.size();
+    }
+
+    /** Moves the data into a chunk, and points the element at it. */
+    void storeChunk (XmlElement& element, MemoryBlock&& data)
+    {
+        element.setAttribute ("chunk", addChunk (static_cast<MemoryBlock&&> (data)));
+    }
+
+    /** Points the element at a chunk that refers to the data rather than copying it,
+        so the data mustn't change until write() is done. snapshotId has to be
+        different whenever the data is.
+    */
+    void storeChunk (XmlElement& element, const MemoryBlock& data, int64 snapshotId)
+    {
+        const ChunkToWrite chunk = { &data, snapshotId };
+        chunksToWrite.add (chunk);
+        element.setAttribute ("chunk", chunksToWrite.size());
+    }
+
+    /** Writes the XML and the chunks added so far. With zlib, chunks are compressed
+        at the fastest setting, and kept as they are if that doesn't make them smaller.
+    */
+    void write (const XmlElement& xml, MemoryBlock& destData, Compression compression,
+                WriteCache* cache = nullptr) const
+    {
+        const String xmlText (xml.createDocument (String(), true, false));
+        Array<int64> snapshotIds;
+
+        for (auto& chunk : chunksToWrite)
+            snapshotIds.add (chunk.snapshotId);
+
+        if (cache != nullptr && cache->compression == compression && cache->data.getSize() > 0
+             && ! snapshotIds.contains (0) && cache->snapshotIds == snapshotIds && cache->xmlText == xmlText)
+        {
+            destData = cache->data;
+            return;
+        }
+
+        size_t totalSize = 8 + (size_t) xmlText.getNumBytesAsUTF8() + chunkHeaderSize;
+
+        for (auto& chunk : chunksToWrite)
+            totalSize += chunk.data->getSize() + chunkHeaderSize;
+
+        destData.reset();
+        MemoryOutputStream out (destData, false);
+        out.preallocate (totalSize);
+
+        writeTo (out, xmlText, compression);
+        out.flush();
+
+        if (cache != nullptr)
+        {
+            cache->xmlText = xmlText;
+            cache->snapshotIds.swapWith (snapshotIds);
+            cache->compression = compression;
+            cache->data = destData;
+        }
+    }
+
+    /** Writes the container to a stream, such as a file, rather than into memory. */
+    void write (const XmlElement& xml, OutputStream& out, Compression compression) const
+    {
+        writeTo (out, xml.createDocument (String(), true, false), compression);
+        out.flush();
+    }
+
+    //==============================================================================
+    static bool isContainer (const void* data, size_t size) noexcept
+    {
+        return size >= 8 && memcmp (data, getMagic(), 4) == 0;
+    }
+
+    /** Returns false if the data isn't a container this version can read. */
+    bool read (const void* data, size_t size)
+    {
+        chunksRead.clearQuick();
+
+        if (! isContainer (data, size))
+            return false;
+
+        MemoryInputStream in (data, size, false);
+        in.skipNextBytes (4);
+
+        const int version = (uint16) in.readShort();
+        const int numChunks = (uint16) in.readShort();
+
+        if (version > currentVersion || numChunks == 0)
+            return false;
+
+        for (int i = 0; i < numChunks; ++i)
+        {
+            if (in.getNumBytesRemaining() < chunkHeaderSize)
+                return false;
+
+            ChunkInfo info;
+            info.flags = (uint8) in.readByte();
+            info.storedSize = (uint64) in.readInt64();
+            info.originalSize = (uint64) in.readInt64();
+            info.data = static_cast<const char*> (data) + in.getPosition();
+
+            if ((info.flags & ~(isCompressed | isDelta)) != 0
+                 || info.storedSize > (uint64) in.getNumBytesRemaining())
+                return false;
+
+            chunksRead.add (info);
+            in.skipNextBytes ((int64) info.storedSize);
+        }
+
+        return true;
+    }
+
+    /** The settings, or nullptr if they can't be parsed. */
+    XmlElement* createXml() const
+    {
+        MemoryBlock xmlText;
+
+        if (! readChunk (0, xmlText))
+            return nullptr;
+
+        return XmlDocument::parse (xmlText.toString());
+    }
+
+    /** Fills dest with the state the element refers to. States saved before this
+        format have it as base64 text inside the element instead.
+    */
+    bool readChunk (const XmlElement& element, MemoryBlock& dest) const
+    {
+        if (element.hasAttribute ("chunk"))
+        {
+            const int index = element.getIntAttribute ("chunk");
+            return index > 0 && readChunk (index, dest);
+        }
+
+        return dest.fromBase64Encoding (element.getAllSubText());
+    }
+
+private:
+    //==============================================================================
+    struct ChunkInfo
+    {
+        uint8 flags;
+        uint64 storedSize, originalSize;
+        const char* data;
+    };
+
+    struct ChunkToWrite
+    {
+        const MemoryBlock* data;
+        int64 snapshotId;
+    };
+
+    enum { isCompressed = 1, isDelta = 2 };
+    enum { chunkHeaderSize = 17 };
+
+    // chunks smaller than this aren't worth making deltas of, and runs of matching
+    // bytes shorter than the minimum match are stored as new bytes
+    enum { minDeltaChunkSize = 16384, minDeltaMatch = 32 };
+
+    Array<ChunkToWrite> chunksToWrite;
+    OwnedArray<MemoryBlock> ownedChunks;
+    Array<ChunkInfo> chunksRead;
+
+    static const char* getMagic() noexcept      { return "RHST"; }
+
+    // the index of an earlier chunk of about the same size, or 0 if there isn't one
+    int findDeltaBase (int index) const
+    {
+        const size_t size = chunksToWrite.getReference (index).data->getSize();
+
+        if (size < minDeltaChunkSize)
+            return 0;
+
+        for (int i = 0; i < index; ++i)
+        {
+            const size_t baseSize = chunksToWrite.getReference (i).data->getSize();
+
+            if (baseSize >= size - size / 8 && baseSize <= size + size / 8)
+                return i + 1;
+        }
+
+        return 0;
+    }
+
+    void writeTo (OutputStream& out, const String& xmlText, Compression compression) const
+    {
+        out.write (getMagic(), 4);
+        out.writeShort ((short) currentVersion);
+        out.writeShort ((short) (chunksToWrite.size() + 1));
+
+        writeChunk (out, xmlText.toRawUTF8(), xmlText.getNumBytesAsUTF8(), 0, stored);
+
+        MemoryOutputStream delta;
+
+        for (int i = 0; i < chunksToWrite.size(); ++i)
+        {
+            const MemoryBlock& data = *chunksToWrite.getReference (i).data;
+            const int baseIndex = findDeltaBase (i);
+
+            delta.reset();
+
+            if (baseIndex > 0)
+            {
+                delta.writeShort ((short) baseIndex);
+
+                if (writeDelta (delta, *chunksToWrite.getReference (baseIndex - 1).data, data))
+                {
+                    writeChunk (out, delta.getData(), delta.getDataSize(), data.getSize(), compression);
+                    continue;
+                }
+            }
+
+            writeChunk (out, data.getData(), data.getSize(), 0, compression);
+        }
+    }
+
+    /** Matches the bytes at the same offsets from the start, and then whatever the
+        two have in common at the end, so a change in length in one place doesn't
+        throw everything after it out. Gives up, returning false, once the delta
+        would be more than half the size of the data.
+    */
+    static bool writeDelta (MemoryOutputStream& out, const MemoryBlock& base, const MemoryBlock& data)
+    {
+        const uint8* b = static_cast<const uint8*> (base.getData());
+        const uint8* d = static_cast<const uint8*> (data.getData());
+        const size_t baseSize = base.getSize(), size = data.getSize();
+        const size_t maxDeltaSize = out.getDataSize() + size / 2;
+
+        size_t suffix = 0;
+
+        while (suffix < jmin (baseSize, size) && b[baseSize - 1 - suffix] == d[size - 1 - suffix])
+            ++suffix;
+
+        const size_t end = size - suffix;
+        const size_t alignedEnd = jmin (end, baseSize - suffix);
+        size_t literalStart = 0, pos = 0;
+
+        while (pos < alignedEnd)
+        {
+            if (d[pos] != b[pos])
+            {
+                ++pos;
+                continue;
+            }
+
+            size_t runEnd = pos + 1;
+
+            while (runEnd < alignedEnd && d[runEnd] == b[runEnd])
+                ++runEnd;
+
+            if (runEnd - pos >= minDeltaMatch)
+            {
+                writeDeltaOp (out, d + literalStart, pos - literalStart, pos, runEnd - pos);
+                literalStart = runEnd;
+
+                if (out.getDataSize() > maxDeltaSize)
+                    return false;
+            }
+
+            pos = runEnd;
+        }
+
+        if (literalStart < end || suffix > 0)
+            writeDeltaOp (out, d + literalStart, end - literalStart, baseSize - suffix, suffix);
+
+        return out.getDataSize() <= maxDeltaSize;
+    }
+
+    static void writeDeltaOp (MemoryOutputStream& out, const uint8* literal, size_t literalSize,
+                              size_t baseOffset, size_t copySize)
+    {
+        out.writeInt ((int) literalSize);
+        out.write (literal, literalSize);
+        out.writeInt ((int) baseOffset);
+        out.writeInt ((int) copySize);
+    }
+
+    // deltaOf is the size of the chunk the data is a delta of, or 0 if it isn't one
+    static void writeChunk (OutputStream& out, const void* data, size_t size, size_t deltaOf, Compression compression)
+    {
+        const uint8 deltaFlag = deltaOf > 0 ? (uint8) isDelta : (uint8) 0;
+        const size_t originalSize = deltaOf > 0 ? deltaOf : size;
+
+        if (compression == zlib && size > 0)
+        {
+            MemoryOutputStream compressed (size / 2);
+
+            {
+                GZIPCompressorOutputStream zipper (&compressed, 1, false);
+                zipper.write (data, size);
+            }
+
+            if (compressed.getDataSize() < size)
+            {
+                out.writeByte ((char) (isCompressed | deltaFlag));
+                out.writeInt64 ((int64) compressed.getDataSize());
+                out.writeInt64 ((int64) originalSize);
+                out.write (compressed.getData(), compressed.getDataSize());
+                return;
+            }
+        }
+
+        out.writeByte ((char) deltaFlag);
+        out.writeInt64 ((int64) size);
+        out.writeInt64 ((int64) originalSize);
+        out.write (data, size);
+    }
+
+    bool readChunk (int index, MemoryBlock& dest) const
+    {
+        if (! isPositiveAndBelow (index, chunksRead.size()))
+            return false;
+
+        const ChunkInfo& info = chunksRead.getReference (index);
+        MemoryBlock unzipped;
+        const char* payload = info.data;
+        size_t payloadSize = (size_t) info.storedSize;
+
+        if ((info.flags & isCompressed) != 0)
+        {
+            // a delta's size isn't known until it has been unzipped
+            GZIPDecompressorInputStream unzipper (new MemoryInputStream (info.data, payloadSize, false), true);
+            unzipper.readIntoMemoryBlock (unzipped);
+
+            payload = static_cast<const char*> (unzipped.getData());
+            payloadSize = unzipped.getSize();
+        }
+
+        if ((info.flags & isDelta) == 0)
+        {
+            if (payloadSize != info.originalSize)
+                return false;
+
+            dest.setSize (payloadSize);
+            dest.copyFrom (payload, 0, payloadSize);
+            return true;
+        }
+
+        // a delta's base always comes before it, so this can't go round in circles
+        MemoryBlock base;
+        MemoryInputStream in (payload, payloadSize, false);
+        const int baseIndex = (uint16) in.readShort();
+
+        if (baseIndex <= 0 || baseIndex >= index || ! readChunk (baseIndex, base))
+            return false;
+
+        const size_t size = (size_t) info.originalSize;
+        dest.setSize (size);
+        char* d = static_cast<char*> (dest.getData());
+        size_t pos = 0;
+
+        while (pos < size)
+        {
+            const size_t literalSize = (uint32) in.readInt();
+
+            if (literalSize > size - pos || (int64) literalSize > in.getNumBytesRemaining())
+                return false;
+
+            in.read (d + pos, (int) literalSize);
+            pos += literalSize;
+
+            const size_t baseOffset = (uint32) in.readInt();
+            const size_t copySize = (uint32) in.readInt();
+
+            if (baseOffset > base.getSize() || copySize > base.getSize() - baseOffset
+                 || copySize > size - pos || (literalSize == 0 && copySize == 0))
+                return false;
+
+            memcpy (d + pos, static_cast<const char*> (base.getData()) + baseOffset, copySize);
+            pos += copySize;
+        }
+
+        return true;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginStateContainer)
+};
@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    A bounded single-producer / single-consumer queue of plain structs.
+
+    push() and pop() never allocate or lock, so one end can live on the audio
+    thread. The storage is allocated once in the constructor; when the queue is
+    full push() fails and the item is dropped.
+*/
+template <typename ItemType>
+class RealtimeFifo
+{
+public:
+    RealtimeFifo (int capacity)
+        : fifo (capacity)
+    {
+        items.calloc ((size_t) capacity);
+    }
+
+    bool push (const ItemType& item) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+        if (size1 + size2 == 0)
+            return false;
+
+        items[size1 > 0 ? start1 : start2] = item;
+        fifo.finishedWrite (1);
+        return true;
+    }
+
+    bool pop (ItemType& item) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (1, start1, size1, start2, size2);
+
+        if (size1 + size2 == 0)
+            return false;
+
+        item = items[size1 > 0 ? start1 : start2];
+        fifo.finishedRead (1);
+        return true;
+    }
+
+    int getNumReady() const noexcept    { return fifo.getNumReady(); }
+    int getCapacity() const noexcept    { return fifo.getTotalSize() - 1; }
+
+    /** Only call this while neither end is in use. */
+    void clear() noexcept               { fifo.reset(); }
+
+private:
+    AbstractFifo fifo;
+    HeapBlock<ItemType> items;
+
+    JUCE_DECLARE_NON_COPYABLE (RealtimeFifo)
+};
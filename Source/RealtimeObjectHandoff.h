@@ -0,0 +1,165 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+
+//==============================================================================
+/**
+    Owns an object that the audio thread uses, and lets other threads replace
+    it without the audio thread ever waiting.
+
+    The audio thread calls acquire() at the start of a callback and release()
+    at the end; while it holds the object, it's advertised in a hazard pointer.
+    set() publishes a new object with a single atomic exchange, and the old one
+    is deleted later, on the message thread, once the audio thread is no longer
+    holding it.
+
+    Other non-realtime threads that use the object (through get()) must hold
+    getLock() for as long as they do, which stops it being deleted under them.
+
+    Objects are deleted through DeletePolicy::destroy(), in the same way as
+    ScopedPointer and OwnedArray do it.
+*/
+template <typename ObjectType, typename DeletePolicy = ContainerDeletePolicy<ObjectType>>
+class RealtimeObjectHandoff  : private Timer
+{
+public:
+    RealtimeObjectHandoff() {}
+
+    ~RealtimeObjectHandoff()
+    {
+        stopTimer();
+
+        // the audio callback must have stopped by now
+        jassert (inUse.get() == nullptr);
+
+        for (auto* o : retired)
+            DeletePolicy::destroy (o);
+
+        DeletePolicy::destroy (current.get());
+    }
+
+    //==============================================================================
+    /** Audio thread: returns the object to use for this callback (may be nullptr). */
+    ObjectType* acquire() noexcept
+    {
+        ObjectType* object;
+
+        // advertise the pointer, then make sure it's still the current one, so
+        // a set() can't have retired it between the load and the store
+        do
+        {
+            object = current.get();
+            inUse = object;
+        }
+        while (object != current.get());
+
+        return object;
+    }
+
+    /** Audio thread: call once the callback has finished with the object. */
+    void release() noexcept
+    {
+        inUse = nullptr;
+    }
+
+    //==============================================================================
+    /** Publishes a new object, which must already be fully prepared. Never waits
+        for the audio thread; the old object is deleted asynchronously.
+    */
+    void set (ObjectType* newObject)
+    {
+        if (ObjectType* old = current.exchange (newObject))
+        {
+            {
+                const ScopedLock sl (lock);
+                retired.add (old);
+            }
+
+            startTimer (20);
+        }
+    }
+
+    /** Publishes a new object and hands back the old one instead of deleting it.
+        The audio thread may still be using the old object, so the caller has to
+        keep it alive until it can be sure it isn't: normally by having already
+        given it to another handoff.
+    */
+    ObjectType* exchange (ObjectType* newObject) noexcept
+    {
+        return current.exchange (newObject);
+    }
+
+    /** For non-realtime threads, which should hold getLock() while using the result. */
+    ObjectType* get() const noexcept                { return current.get(); }
+    ObjectType* operator->() const noexcept         { return current.get(); }
+
+    const CriticalSection& getLock() const noexcept { return lock; }
+
+    int getNumRetired() const
+    {
+        const ScopedLock sl (lock);
+        return retired.size();
+    }
+
+private:
+    Atomic<ObjectType*> current, inUse;
+
+    CriticalSection lock;
+    Array<ObjectType*> retired;
+
+    void timerCallback() override
+    {
+        // someone is using the current object; try again next time rather than wait
+        const ScopedTryLock stl (lock);
+
+        if (! stl.isLocked())
+            return;
+
+        for (int i = retired.size(); --i >= 0;)
+            if (retired.getUnchecked (i) != inUse.get())
+                DeletePolicy::destroy (retired.removeAndReturn (i));
+
+        if (retired.isEmpty())
+            stopTimer();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeObjectHandoff)
+};
+
+//==============================================================================
+/** For a handoff of plugin instances: a retired instance is told to release its
+    resources before it's deleted, as it won't be called again.
+*/
+struct PluginInstanceDeletePolicy
+{
+    static void destroy (AudioPluginInstance* instance)
+    {
+        if (instance != nullptr)
+        {
+            instance->releaseResources();
+            delete instance;
+        }
+    }
+};
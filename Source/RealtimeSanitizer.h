@@ -0,0 +1,144 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// 1 to report the audio thread allocating, locking or blocking (a debug-only mode)
+#ifndef REAKTORHOST_REALTIME_SANITIZER
+ #define REAKTORHOST_REALTIME_SANITIZER 0
+#endif
+
+
+//==============================================================================
+/**
+    A debug mode that catches the audio thread doing something that can block.
+
+    The realtime paths are marked with a ScopedRealtimeSection. Built with
+    REAKTORHOST_REALTIME_SANITIZER=1, for instance with
+
+        make CONFIG=Debug CPPFLAGS=-DREAKTORHOST_REALTIME_SANITIZER=1
+
+    any call to malloc, free, operator new or delete, a mutex lock, a condition
+    or semaphore wait, socket and file I/O or a sleep made by a thread inside one
+    is reported on stderr with a stack backtrace, then carried out as usual.
+
+    The hooks are in RealtimeSanitizerHooks.h, which one file in each binary
+    includes, and only exist on Linux. With the flag off, all of this compiles
+    to nothing.
+*/
+namespace RealtimeSanitizer
+{
+   #if REAKTORHOST_REALTIME_SANITIZER
+    enum { maxNumReports = 200 };
+
+    struct ThreadState
+    {
+        int realtimeDepth;
+        int exemptionDepth;
+        bool isReporting;
+    };
+
+    inline ThreadState& getThreadState() noexcept
+    {
+        // zero-initialised, so it's set up without allocating
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    inline bool isCheckingThisThread() noexcept
+    {
+        const ThreadState& state = getThreadState();
+        return state.realtimeDepth > 0 && state.exemptionDepth == 0 && ! state.isReporting;
+    }
+
+    /** Prints what was called, and from where. Whatever the report itself allocates isn't reported. */
+    inline void reportViolation (const char* functionName) noexcept
+    {
+        static Atomic<int> numReports;
+        ThreadState& state = getThreadState();
+        state.isReporting = true;
+
+        const int reportNumber = ++numReports;
+
+        if (reportNumber <= maxNumReports)
+        {
+            fprintf (stderr, "Realtime violation: %s called on a realtime thread\n%s\n",
+                     functionName, SystemStats::getStackBacktrace().toRawUTF8());
+
+            if (reportNumber == maxNumReports)
+                fprintf (stderr, "Realtime violation: too many reports, no more will be printed\n");
+        }
+
+        state.isReporting = false;
+    }
+
+    /** Marks the current thread as realtime for as long as it exists. Nests. */
+    struct ScopedRealtimeSection
+    {
+        ScopedRealtimeSection() noexcept        { ++getThreadState().realtimeDepth; }
+        ~ScopedRealtimeSection() noexcept       { --getThreadState().realtimeDepth; }
+    };
+
+    /** Lets a realtime thread make calls that would otherwise be reported. */
+    struct ScopedExemption
+    {
+        ScopedExemption() noexcept              { ++getThreadState().exemptionDepth; }
+        ~ScopedExemption() noexcept             { --getThreadState().exemptionDepth; }
+    };
+   #else
+    struct ScopedRealtimeSection
+    {
+        ScopedRealtimeSection() noexcept {}
+    };
+
+    struct ScopedExemption
+    {
+        ScopedExemption() noexcept {}
+    };
+   #endif
+
+    //==============================================================================
+    /** Holds a lock that the realtime path is meant to take, such as a processor's
+        callback lock, which is only contended while the processor is being set up.
+        Taking it isn't reported; what's done while holding it still is.
+    */
+    template <typename LockType>
+    struct ScopedExpectedLock
+    {
+        explicit ScopedExpectedLock (const LockType& l) noexcept  : lock (l)
+        {
+            const ScopedExemption exemption;
+            lock.enter();
+        }
+
+        ~ScopedExpectedLock() noexcept
+        {
+            lock.exit();
+        }
+
+        const LockType& lock;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedExpectedLock)
+    };
+}
@@ -0,0 +1,288 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+
+#pragma once
+
+#include "RealtimeSanitizer.h"
+
+/*  The functions RealtimeSanitizer watches, wrapped. Include this in exactly one
+    file of each binary.
+
+    The wrappers are hidden, so calls made by the code linked into this binary
+    come here even when it's a plugin inside a host, and weak, so that a program
+    which replaces operator new itself (like the benchmarks) keeps its own. Each
+    one passes the call on to the next definition along, normally the C library's.
+*/
+#if REAKTORHOST_REALTIME_SANITIZER && JUCE_LINUX
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+
+#define REAKTORHOST_REALTIME_HOOK  __attribute__ ((weak))
+
+// the system headers have already declared these with default visibility, so they're
+// hidden at the assembler instead (the operators are size_t = unsigned long builds')
+__asm__ (".hidden malloc\n .hidden calloc\n .hidden realloc\n .hidden posix_memalign\n .hidden free\n"
+         ".hidden pthread_mutex_lock\n .hidden pthread_cond_wait\n .hidden pthread_cond_timedwait\n .hidden sem_wait\n"
+         ".hidden read\n .hidden write\n .hidden send\n .hidden sendto\n .hidden recv\n .hidden recvfrom\n"
+         ".hidden poll\n .hidden select\n .hidden nanosleep\n .hidden usleep\n"
+         ".hidden _Znwm\n .hidden _Znam\n .hidden _ZnwmRKSt9nothrow_t\n .hidden _ZnamRKSt9nothrow_t\n"
+         ".hidden _ZdlPv\n .hidden _ZdaPv\n .hidden _ZdlPvm\n .hidden _ZdaPvm");
+
+namespace RealtimeSanitizer
+{
+    template <typename FunctionType>
+    static FunctionType findNext (const char* name, const char* version = nullptr) noexcept
+    {
+        void* function = version != nullptr ? dlvsym (RTLD_NEXT, name, version) : nullptr;
+
+        if (function == nullptr)
+            function = dlsym (RTLD_NEXT, name);
+
+        jassert (function != nullptr);
+        return reinterpret_cast<FunctionType> (function);
+    }
+
+    static void check (const char* functionName) noexcept
+    {
+        if (isCheckingThisThread())
+            reportViolation (functionName);
+    }
+
+    static void* callMalloc (size_t size) noexcept
+    {
+        static auto next = findNext<void* (*) (size_t)> ("malloc");
+        return next (size);
+    }
+
+    static void callFree (void* p) noexcept
+    {
+        static auto next = findNext<void (*) (void*)> ("free");
+        next (p);
+    }
+}
+
+//==============================================================================
+extern "C"
+{
+    REAKTORHOST_REALTIME_HOOK void* malloc (size_t size)
+    {
+        RealtimeSanitizer::check ("malloc");
+        return RealtimeSanitizer::callMalloc (size);
+    }
+
+    REAKTORHOST_REALTIME_HOOK void* calloc (size_t numElements, size_t elementSize)
+    {
+        static auto next = RealtimeSanitizer::findNext<void* (*) (size_t, size_t)> ("calloc");
+        RealtimeSanitizer::check ("calloc");
+        return next (numElements, elementSize);
+    }
+
+    REAKTORHOST_REALTIME_HOOK void* realloc (void* p, size_t size)
+    {
+        static auto next = RealtimeSanitizer::findNext<void* (*) (void*, size_t)> ("realloc");
+        RealtimeSanitizer::check ("realloc");
+        return next (p, size);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int posix_memalign (void** result, size_t alignment, size_t size)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (void**, size_t, size_t)> ("posix_memalign");
+        RealtimeSanitizer::check ("posix_memalign");
+        return next (result, alignment, size);
+    }
+
+    REAKTORHOST_REALTIME_HOOK void free (void* p)
+    {
+        if (p != nullptr)
+            RealtimeSanitizer::check ("free");
+
+        RealtimeSanitizer::callFree (p);
+    }
+
+    //==============================================================================
+    REAKTORHOST_REALTIME_HOOK int pthread_mutex_lock (pthread_mutex_t* mutex)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (pthread_mutex_t*)> ("pthread_mutex_lock");
+        RealtimeSanitizer::check ("pthread_mutex_lock");
+        return next (mutex);
+    }
+
+    // the unversioned symbols are the old condition variables on some platforms
+    REAKTORHOST_REALTIME_HOOK int pthread_cond_wait (pthread_cond_t* condition, pthread_mutex_t* mutex)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (pthread_cond_t*, pthread_mutex_t*)> ("pthread_cond_wait", "GLIBC_2.3.2");
+        RealtimeSanitizer::check ("pthread_cond_wait");
+        return next (condition, mutex);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int pthread_cond_timedwait (pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (pthread_cond_t*, pthread_mutex_t*, const struct timespec*)> ("pthread_cond_timedwait", "GLIBC_2.3.2");
+        RealtimeSanitizer::check ("pthread_cond_timedwait");
+        return next (condition, mutex, time);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int sem_wait (sem_t* semaphore)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (sem_t*)> ("sem_wait");
+        RealtimeSanitizer::check ("sem_wait");
+        return next (semaphore);
+    }
+
+    //==============================================================================
+    REAKTORHOST_REALTIME_HOOK ssize_t read (int fd, void* buffer, size_t numBytes)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, void*, size_t)> ("read");
+        RealtimeSanitizer::check ("read");
+        return next (fd, buffer, numBytes);
+    }
+
+    REAKTORHOST_REALTIME_HOOK ssize_t write (int fd, const void* buffer, size_t numBytes)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, const void*, size_t)> ("write");
+        RealtimeSanitizer::check ("write");
+        return next (fd, buffer, numBytes);
+    }
+
+    REAKTORHOST_REALTIME_HOOK ssize_t send (int socket, const void* buffer, size_t numBytes, int flags)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, const void*, size_t, int)> ("send");
+        RealtimeSanitizer::check ("send");
+        return next (socket, buffer, numBytes, flags);
+    }
+
+    REAKTORHOST_REALTIME_HOOK ssize_t sendto (int socket, const void* buffer, size_t numBytes, int flags,
+                                              const struct sockaddr* address, socklen_t addressLength)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, const void*, size_t, int, const struct sockaddr*, socklen_t)> ("sendto");
+        RealtimeSanitizer::check ("sendto");
+        return next (socket, buffer, numBytes, flags, address, addressLength);
+    }
+
+    REAKTORHOST_REALTIME_HOOK ssize_t recv (int socket, void* buffer, size_t numBytes, int flags)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, void*, size_t, int)> ("recv");
+        RealtimeSanitizer::check ("recv");
+        return next (socket, buffer, numBytes, flags);
+    }
+
+    REAKTORHOST_REALTIME_HOOK ssize_t recvfrom (int socket, void* buffer, size_t numBytes, int flags,
+                                                struct sockaddr* address, socklen_t* addressLength)
+    {
+        static auto next = RealtimeSanitizer::findNext<ssize_t (*) (int, void*, size_t, int, struct sockaddr*, socklen_t*)> ("recvfrom");
+        RealtimeSanitizer::check ("recvfrom");
+        return next (socket, buffer, numBytes, flags, address, addressLength);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int poll (struct pollfd* fds, nfds_t numFds, int timeoutMs)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (struct pollfd*, nfds_t, int)> ("poll");
+        RealtimeSanitizer::check ("poll");
+        return next (fds, numFds, timeoutMs);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int select (int numFds, fd_set* readFds, fd_set* writeFds, fd_set* exceptFds, struct timeval* timeout)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (int, fd_set*, fd_set*, fd_set*, struct timeval*)> ("select");
+        RealtimeSanitizer::check ("select");
+        return next (numFds, readFds, writeFds, exceptFds, timeout);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int nanosleep (const struct timespec* duration, struct timespec* remaining)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (const struct timespec*, struct timespec*)> ("nanosleep");
+        RealtimeSanitizer::check ("nanosleep");
+        return next (duration, remaining);
+    }
+
+    REAKTORHOST_REALTIME_HOOK int usleep (useconds_t microseconds)
+    {
+        static auto next = RealtimeSanitizer::findNext<int (*) (useconds_t)> ("usleep");
+        RealtimeSanitizer::check ("usleep");
+        return next (microseconds);
+    }
+}
+
+//==============================================================================
+// operator new lives in the C++ runtime, whose calls to malloc don't come here
+REAKTORHOST_REALTIME_HOOK void* operator new (size_t size)
+{
+    RealtimeSanitizer::check ("operator new");
+
+    if (void* p = RealtimeSanitizer::callMalloc (size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+REAKTORHOST_REALTIME_HOOK void* operator new[] (size_t size)
+{
+    RealtimeSanitizer::check ("operator new[]");
+
+    if (void* p = RealtimeSanitizer::callMalloc (size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+REAKTORHOST_REALTIME_HOOK void* operator new (size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSanitizer::check ("operator new");
+    return RealtimeSanitizer::callMalloc (size);
+}
+
+REAKTORHOST_REALTIME_HOOK void* operator new[] (size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSanitizer::check ("operator new[]");
+    return RealtimeSanitizer::callMalloc (size);
+}
+
+REAKTORHOST_REALTIME_HOOK void operator delete (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeSanitizer::check ("operator delete");
+
+    RealtimeSanitizer::callFree (p);
+}
+
+REAKTORHOST_REALTIME_HOOK void operator delete[] (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeSanitizer::check ("operator delete[]");
+
+    RealtimeSanitizer::callFree (p);
+}
+
+REAKTORHOST_REALTIME_HOOK void operator delete (void* p, size_t) noexcept      { operator delete (p); }
+REAKTORHOST_REALTIME_HOOK void operator delete[] (void* p, size_t) noexcept    { operator delete[] (p); }
+
+#undef REAKTORHOST_REALTIME_HOOK
+
+#endif
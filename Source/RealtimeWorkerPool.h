@@ -0,0 +1,242 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RealtimeSanitizer.h"
+
+
+//==============================================================================
+/**
+    A few high-priority threads that help the audio thread get through a block.
+
+    perform() hands out a job's tasks to whichever thread asks first, the audio
+    thread included, and returns once every task has finished. Tasks are claimed
+    with a compare-and-swap, so the audio thread never locks or allocates. It
+    only signals a worker that has gone to sleep: workers keep spinning for a
+    couple of milliseconds after their last task, which normally covers the gap
+    to the next block.
+
+    Workers are only ever added, so the audio thread can't see one being deleted;
+    setNumWorkers() with a smaller number just leaves the extra ones asleep.
+    Workers can be pinned to a core each, leaving the first core to the audio thread.
+*/
+class RealtimeWorkerPool
+{
+public:
+    enum { maxWorkers = 16 };
+
+    struct Job
+    {
+        virtual ~Job() {}
+
+        /** Called once for each task index, on any of the pool's threads. */
+        virtual void runTask (int taskIndex) noexcept = 0;
+    };
+
+    RealtimeWorkerPool() {}
+
+    ~RealtimeWorkerPool()
+    {
+        for (int i = 0; i < numWorkers.get(); ++i)
+            workers[i]->signalThreadShouldExit();
+
+        for (int i = 0; i < numWorkers.get(); ++i)
+            delete workers[i];
+    }
+
+    //==============================================================================
+    /** Don't call this on the audio thread. */
+    void setNumWorkers (int newNumWorkers)
+    {
+        newNumWorkers = jlimit (0, (int) maxWorkers, newNumWorkers);
+
+        const ScopedLock sl (lock);
+
+        for (int i = numWorkers.get(); i < newNumWorkers; ++i)
+        {
+            workers[i] = new Worker (*this, i);
+
+            if (pinsWorkersToCores)
+                workers[i]->setAffinityMask ((uint32) 1 << ((i + 1) % jmin (32, SystemStats::getNumCpus())));
+
+            workers[i]->startThread (9);
+            numWorkers = i + 1;
+        }
+
+        numActiveWorkers = newNumWorkers;
+    }
+
+    int getNumWorkers() const noexcept          { return numActiveWorkers.get(); }
+
+    /** Only affects workers that haven't been started yet. */
+    void setPinsWorkersToCores (bool shouldPin)
+    {
+        const ScopedLock sl (lock);
+        pinsWorkersToCores = shouldPin;
+    }
+
+    //==============================================================================
+    /** Audio thread: runs job.runTask() for every index below numTasks, spread over
+        the workers and the calling thread, and returns when they've all finished.
+        Only one thread may call this at a time.
+    */
+    void perform (Job& job, int numTasks) noexcept
+    {
+        const int numHelpers = jmin (numActiveWorkers.get(), numWorkers.get(), numTasks - 1);
+
+        if (numHelpers <= 0)
+        {
+            for (int i = 0; i < numTasks; ++i)
+                job.runTask (i);
+
+            return;
+        }
+
+        // nobody can claim a task while the job is being swapped in, and a worker
+        // that read the previous generation fails its compare-and-swap
+        const int64 generation = (state.get() >> 32) + 1;
+        state = (generation << 32) | closedIndex;
+
+        currentJob = &job;
+        numTasksInJob = numTasks;
+        numTasksFinished = 0;
+
+        state = generation << 32;
+
+        for (int i = 0; i < numHelpers; ++i)
+            if (workers[i]->isSleeping.get() != 0)
+                workers[i]->notify();
+
+        runAvailableTasks();
+
+        while (numTasksFinished.get() < numTasks)
+        {
+            // the last tasks are running on the workers
+        }
+    }
+
+private:
+    //==============================================================================
+    struct Worker  : public Thread
+    {
+        Worker (RealtimeWorkerPool& p, int i)
+            : Thread ("Realtime worker " + String (i + 1)), pool (p), index (i)
+        {}
+
+        ~Worker()
+        {
+            stopThread (1000);
+        }
+
+        void run() override
+        {
+            FloatVectorOperations::disableDenormalisedNumberSupport();
+
+            double lastTaskMs = Time::getMillisecondCounterHiRes();
+
+            while (! threadShouldExit())
+            {
+                const bool isActive = index < pool.numActiveWorkers.get();
+
+                if (isActive && pool.runAvailableTasks())
+                {
+                    lastTaskMs = Time::getMillisecondCounterHiRes();
+                    continue;
+                }
+
+                if (isActive && Time::getMillisecondCounterHiRes() - lastTaskMs < spinMs)
+                {
+                    Thread::yield();
+                    continue;
+                }
+
+                // perform() checks the flag after publishing its job, and a notify()
+                // that lands before the wait isn't lost
+                isSleeping = 1;
+
+                if (! pool.hasAvailableTasks())
+                    wait (100);
+
+                isSleeping = 0;
+                lastTaskMs = Time::getMillisecondCounterHiRes();
+            }
+        }
+
+        RealtimeWorkerPool& pool;
+        const int index;
+        Atomic<int> isSleeping;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Worker)
+    };
+
+    static constexpr double spinMs = 2.0;
+    static constexpr int64 closedIndex = 0x7fffffff;
+
+    // the job's generation in the top half, the next task to hand out in the bottom
+    Atomic<int64> state;
+    Atomic<Job*> currentJob;
+    Atomic<int> numTasksInJob, numTasksFinished;
+
+    CriticalSection lock;
+    Worker* workers[maxWorkers] = {};
+    Atomic<int> numWorkers, numActiveWorkers;
+    bool pinsWorkersToCores = false;
+
+    //==============================================================================
+    bool hasAvailableTasks() const noexcept
+    {
+        const int index = (int) (state.get() & 0xffffffff);
+        return index != closedIndex && index < numTasksInJob.get();
+    }
+
+    // claims and runs tasks until there are none left; returns false if it got none
+    bool runAvailableTasks() noexcept
+    {
+        bool hasRunTask = false;
+
+        for (;;)
+        {
+            const int64 s = state.get();
+            const int index = (int) (s & 0xffffffff);
+
+            if (index == closedIndex)
+                return hasRunTask;
+
+            // only valid if the state hasn't moved on by the time the claim succeeds
+            Job* job = currentJob.get();
+
+            if (index >= numTasksInJob.get())
+                return hasRunTask;
+
+            if (! state.compareAndSetBool (s + 1, s))
+                continue;
+
+            const RealtimeSanitizer::ScopedRealtimeSection realtimeSection;
+            job->runTask (index);
+            ++numTasksFinished;
+            hasRunTask = true;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeWorkerPool)
+};
@@ -0,0 +1,414 @@
+/*
+  ==============================================================================
+
+ Copyright (C) 2017  Lucas Paris
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "FxpPresetCache.h"
+#include "PluginInstanceRequest.h"
+#include "ParameterAddressIndex.h"
+
+#if JUCE_MAC
+ #include <mach/mach.h>
+#elif JUCE_LINUX
+ #include <unistd.h>
+#endif
+
+
+//==============================================================================
+/**
+    Keeps a number of plugin instances created, loaded with a preset and
+    prepared to play, so that switching ensembles during a show doesn't wait
+    for the plugin to be instantiated.
+
+    Each slot is configured with a preset name (an empty name leaves the
+    plugin in its default state). A background thread fills the slots, and
+    refills a slot as soon as its instance has been taken. When the sample rate
+    or block size changes, instances that are waiting are prepared again.
+
+    Each slot's OSC address table is built when it's filled too, so a switch
+    only has to publish it along with the instance.
+
+    For sizing the pool, each slot reports roughly how much memory its
+    instance added to the process, and what fraction of a block's duration it
+    takes to process one block.
+*/
+class StandbyInstancePool  : private Thread
+{
+public:
+    struct SlotInfo
+    {
+        String presetName;
+        bool isReady;
+        int64 memoryBytes;          // growth of the process's resident size while it was created, or 0 if unknown
+        double cpuLoad;             // time to process a block / the block's duration
+        double creationSeconds;
+    };
+
+    StandbyInstancePool (AudioPluginFormatManager& formats, FxpPresetCache& presets)
+        : Thread ("Standby instance pool"), formatManager (formats), presetCache (presets)
+    {
+        startThread (3);
+    }
+
+    ~StandbyInstancePool()
+    {
+        stopThread (10000);
+    }
+
+    //==============================================================================
+    /** The plugin the slots are filled with. Changing it empties the pool. */
+    void setPluginDescription (const PluginDescription& newDescription)
+    {
+        {
+            const ScopedLock sl (lock);
+
+            if (description.createIdentifierString() == newDescription.createIdentifierString())
+                return;
+
+            description = newDescription;
+            hasDescription = true;
+
+            for (auto* slot : slots)
+                slot->clear();
+        }
+
+        notify();
+    }
+
+    void setSlots (const StringArray& presetNames)
+    {
+        {
+            const ScopedLock sl (lock);
+
+            for (int i = 0; i < presetNames.size(); ++i)
+            {
+                if (i >= slots.size())
+                    slots.add (new Slot());
+
+                if (slots.getUnchecked (i)->presetName != presetNames[i])
+                {
+                    slots.getUnchecked (i)->clear();
+                    slots.getUnchecked (i)->presetName = presetNames[i];
+                }
+            }
+
+            slots.removeRange (presetNames.size(), slots.size());
+        }
+
+        notify();
+    }
+
+    StringArray getSlots() const
+    {
+        const ScopedLock sl (lock);
+        StringArray names;
+
+        for (auto* slot : slots)
+            names.add (slot->presetName);
+
+        return names;
+    }
+
+    int indexOfSlot (const String& presetName) const
+    {
+        const ScopedLock sl (lock);
+
+        for (int i = 0; i < slots.size(); ++i)
+            if (slots.getUnchecked (i)->presetName == presetName)
+                return i;
+
+        return -1;
+    }
+
+    /** Slots filled under a different rule hand over their instance without a table. */
+    void setAddressMappingRule (ParameterAddressIndex::MappingRule newRule)
+    {
+        const ScopedLock sl (lock);
+        addressMappingRule = newRule;
+    }
+
+    void setPlaybackConfiguration (double newSampleRate, int newBlockSize)
+    {
+        {
+            const ScopedLock sl (lock);
+            sampleRate = newSampleRate;
+            blockSize = newBlockSize;
+        }
+
+        notify();
+    }
+
+    //==============================================================================
+    /** Hands over a ready instance, or returns nullptr if the slot is still being
+        filled. The caller owns the result, and the slot is refilled in the background.
+
+        If asked for, the instance's address table and the hashChunk() of its preset
+        are handed over too; the table is nullptr if it was built under another rule.
+    */
+    AudioPluginInstance* takeInstance (int slotIndex, OscAddressDispatcher::Ptr* dispatcher = nullptr,
+                                       int64* contentHash = nullptr)
+    {
+        AudioPluginInstance* instance = nullptr;
+
+        {
+            const ScopedLock sl (lock);
+
+            if (Slot* slot = slots[slotIndex])
+            {
+                if (slot->instance != nullptr)
+                {
+                    if (dispatcher != nullptr)
+                        *dispatcher = slot->dispatcherRule == addressMappingRule ? slot->dispatcher : nullptr;
+
+                    if (contentHash != nullptr)
+                        *contentHash = slot->contentHash;
+                }
+
+                instance = slot->instance.release();
+            }
+        }
+
+        if (instance != nullptr)
+            notify();
+
+        return instance;
+    }
+
+    Array<SlotInfo> getSlotInfo() const
+    {
+        const ScopedLock sl (lock);
+        Array<SlotInfo> info;
+
+        for (auto* slot : slots)
+            info.add ({ slot->presetName, slot->instance != nullptr, slot->memoryBytes, slot->cpuLoad, slot->creationSeconds });
+
+        return info;
+    }
+
+private:
+    struct Slot
+    {
+        String presetName;
+        ScopedPointer<AudioPluginInstance> instance;
+        double preparedSampleRate = 0;
+        int preparedBlockSize = 0;
+
+        // bumped whenever the slot's configuration changes, so work done for an
+        // old configuration is thrown away
+        int generation = 0;
+
+        int64 memoryBytes = 0;
+        double cpuLoad = 0, creationSeconds = 0;
+
+        OscAddressDispatcher::Ptr dispatcher;
+        ParameterAddressIndex::MappingRule dispatcherRule = ParameterAddressIndex::slashPrefixed;
+        int64 contentHash = ParameterAddressIndex::unknownContents;
+
+        void clear()
+        {
+            instance = nullptr;
+            dispatcher = nullptr;
+            contentHash = ParameterAddressIndex::unknownContents;
+            ++generation;
+        }
+    };
+
+    AudioPluginFormatManager& formatManager;
+    FxpPresetCache& presetCache;
+
+    CriticalSection lock;
+    OwnedArray<Slot> slots;
+    PluginDescription description;
+    bool hasDescription = false;
+    double sampleRate = 44100.0;
+    int blockSize = 512;
+
+    SharedResourcePointer<ParameterAddressIndex> addressIndex;
+    ParameterAddressIndex::MappingRule addressMappingRule = ParameterAddressIndex::slashPrefixed;
+
+    //==============================================================================
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            if (! fillNextSlot())
+                wait (1000);
+        }
+    }
+
+    // instantiates or re-prepares one slot; returns false if there was nothing to do
+    bool fillNextSlot()
+    {
+        PluginDescription desc;
+        String presetName;
+        ScopedPointer<AudioPluginInstance> instance;
+        ParameterAddressIndex::MappingRule rule;
+        double rate;
+        int size, slotIndex = -1, generation = 0;
+
+        {
+            const ScopedLock sl (lock);
+
+            if (! hasDescription)
+                return false;
+
+            for (int i = 0; i < slots.size() && slotIndex < 0; ++i)
+            {
+                Slot& slot = *slots.getUnchecked (i);
+
+                if (slot.instance == nullptr || slot.preparedSampleRate != sampleRate || slot.preparedBlockSize != blockSize)
+                {
+                    slotIndex = i;
+                    generation = slot.generation;
+                    presetName = slot.presetName;
+
+                    // an instance that only needs preparing again is taken out while that happens
+                    instance = slot.instance.release();
+                }
+            }
+
+            if (slotIndex < 0)
+                return false;
+
+            desc = description;
+            rule = addressMappingRule;
+            rate = sampleRate;
+            size = blockSize;
+        }
+
+        int64 memoryBytes = 0, contentHash = ParameterAddressIndex::unknownContents;
+        double cpuLoad = 0, creationSeconds = 0;
+        OscAddressDispatcher::Ptr dispatcher;
+        const bool isNew = (instance == nullptr);
+
+        if (isNew)
+        {
+            const int64 memoryBefore = getProcessResidentBytes();
+            const double startTime = Time::getMillisecondCounterHiRes();
+
+            instance = PluginInstanceRequest::create (formatManager, desc, rate, size, *this);
+
+            if (instance == nullptr)
+            {
+                // don't spin on a plugin that won't load
+                wait (5000);
+                return true;
+            }
+
+            instance->enableAllBuses();
+
+            if (presetName.isNotEmpty())
+            {
+                if (FxpPreset::Ptr preset = presetCache.getPreset (presetName))
+                {
+                   #if JUCE_PLUGINHOST_VST
+                    VSTPluginFormat::loadFromFXBFile (instance, preset->data.getData(), preset->data.getSize());
+                   #endif
+                    contentHash = ParameterAddressIndex::hashChunk (preset->data);
+                }
+            }
+
+            instance->prepareToPlay (rate, size);
+            creationSeconds = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+            // built here rather than when switching, as it reads every parameter name
+            dispatcher = addressIndex->getDispatcherFor (*instance, rule, contentHash);
+
+            const int64 memoryAfter = getProcessResidentBytes();
+            memoryBytes = jmax ((int64) 0, memoryAfter - memoryBefore);
+        }
+        else
+        {
+            instance->releaseResources();
+            instance->prepareToPlay (rate, size);
+        }
+
+        cpuLoad = measureCpuLoad (*instance, rate, size);
+
+        const ScopedLock sl (lock);
+
+        if (Slot* slot = slots[slotIndex])
+        {
+            if (slot->generation == generation && slot->instance == nullptr)
+            {
+                slot->instance = instance.release();
+                slot->preparedSampleRate = rate;
+                slot->preparedBlockSize = size;
+                slot->cpuLoad = cpuLoad;
+
+                if (isNew)
+                {
+                    slot->memoryBytes = memoryBytes;
+                    slot->creationSeconds = creationSeconds;
+                    slot->dispatcher = dispatcher;
+                    slot->dispatcherRule = rule;
+                    slot->contentHash = contentHash;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // runs a few blocks of silence through the instance, then resets it
+    static double measureCpuLoad (AudioPluginInstance& instance, double rate, int size)
+    {
+        enum { numBlocks = 8 };
+
+        AudioBuffer<float> buffer (jmax (1, instance.getTotalNumInputChannels(), instance.getTotalNumOutputChannels()), size);
+        MidiBuffer midi;
+
+        const int64 startTicks = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            buffer.clear();
+            midi.clear();
+            instance.processBlock (buffer, midi);
+        }
+
+        const double seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+        instance.reset();
+
+        return seconds / numBlocks / (size / rate);
+    }
+
+    static int64 getProcessResidentBytes()
+    {
+       #if JUCE_LINUX
+        const StringArray fields (StringArray::fromTokens (File ("/proc/self/statm").loadFileAsString(), true));
+        return fields[1].getLargeIntValue() * (int64) sysconf (_SC_PAGESIZE);
+       #elif JUCE_MAC
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+        if (task_info (mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+            return (int64) info.resident_size;
+
+        return 0;
+       #else
+        return 0;
+       #endif
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StandbyInstancePool)
+};